@@ -8,6 +8,7 @@
  *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
  */
 
+#include "dump.h"
 #include "types.h"
 #include "utils.h"
 #include "gfx.h"
@@ -21,15 +22,25 @@
 #include "sdcard.h"
 #include "mlc.h"
 #include "nand.h"
+#include "nand_map.h"
+#include "pipeline.h"
+#include "manifest.h"
+#include "progress.h"
+#include "lz4.h"
+#include "tuning.h"
 
 #include "ff.h"
 
 #include "smc.h"
 #include "crypto.h"
+#include "sha.h"
 
 // TODO: how many sectors is 8gb MLC WFS?
 #define TOTAL_SECTORS (0x3A20000)
 
+// attempts per chunk before a dump gives up
+#define DUMP_RETRIES (16)
+
 extern seeprom_t seeprom;
 extern otp_t otp;
 
@@ -95,22 +106,1664 @@ void dump_seeprom_otp()
     fwrite(&otp, 1, sizeof(otp_t), f_otp);
     fclose(f_otp);
 
-    FILE* f_eep = fopen("sdmc:/seeprom.bin", "wb");
-    if(!f_eep)
-    {
-        printf("Failed to open sdmc:/seeprom.bin.\n");
-        goto ret;
+    FILE* f_eep = fopen("sdmc:/seeprom.bin", "wb");
+    if(!f_eep)
+    {
+        printf("Failed to open sdmc:/seeprom.bin.\n");
+        goto ret;
+    }
+    fwrite(&seeprom, 1, sizeof(seeprom_t), f_eep);
+    fclose(f_eep);
+
+    printf("\nDone!\n");
+ret:
+    printf("Press POWER or EJECT to return...\n");
+    smc_wait_events(SMC_POWER_BUTTON | SMC_EJECT_BUTTON);
+}
+
+static const char* _dump_bank_name(u32 bank)
+{
+    switch(bank) {
+        case NAND_BANK_SLC: return "SLC";
+        case NAND_BANK_SLCCMPT: return "SLCCMPT";
+        default: return NULL;
+    }
+}
+
+// Pipeline stages shared by the dumps. SD and MLC chunks go out as one stream,
+// an open-ended transfer that carries on from one chunk to the next as long as
+// they follow on (see sdhc_stream_open()), so there's no command in between.
+// Anything that can't stream (a short or unaligned chunk) is split into commands
+// of up to SDHC_BLOCK_COUNT_MAX sectors instead, which are queued on the host
+// controller all at once (as far as the queue goes), so each starts from the IRQ
+// handler as soon as the last one is done.
+typedef struct {
+    int (*start)(u32 blk_start, u32 blk_count, void* data, struct sdmmc_command* cmdbuf);
+    int (*end)(struct sdmmc_command* cmdbuf);
+    int (*open)(u32 blk_start, int write, struct sdhc_stream* stream);
+    bool write;
+} dump_sdmmc_ops;
+
+static const dump_sdmmc_ops mlc_read_ops = {mlc_start_read, mlc_end_read, mlc_open_stream, false};
+static const dump_sdmmc_ops mlc_write_ops = {mlc_start_write, mlc_end_write, mlc_open_stream, true};
+static const dump_sdmmc_ops sdcard_read_ops = {sdcard_start_read, sdcard_end_read, sdcard_open_stream, false};
+static const dump_sdmmc_ops sdcard_write_ops = {sdcard_start_write, sdcard_end_write, sdcard_open_stream, true};
+
+typedef struct {
+    u32 base;
+    // sectors per pipeline block
+    u32 sectors;
+    struct sdmmc_command cmds[SDHC_QUEUE_DEPTH];
+
+    // what's left of the transfer in flight, and the commands queued and
+    // waited for so far
+    u32 next;
+    u32 left;
+    u8* data;
+    u32 issued;
+    u32 waited;
+
+    // whether the chunk in flight went to the stream, where the stream
+    // carries on, and the chunks pushed to it so far
+    struct sdhc_stream stream;
+    bool streaming;
+    u32 stream_next;
+    u32 pushed;
+} dump_sdmmc_stage;
+
+static int _dump_sdmmc_issue(dump_sdmmc_stage* stage, const dump_sdmmc_ops* ops)
+{
+    while(stage->left && stage->issued - stage->waited < SDHC_QUEUE_DEPTH) {
+        u32 count = min(stage->left, (u32)SDHC_BLOCK_COUNT_MAX);
+        int res = ops->start(stage->next, count, stage->data, &stage->cmds[stage->issued % SDHC_QUEUE_DEPTH]);
+        if(res) return res;
+
+        stage->issued++;
+        stage->next += count;
+        stage->left -= count;
+        stage->data += count * SDMMC_DEFAULT_BLOCKLEN;
+    }
+
+    return 0;
+}
+
+static int _dump_sdmmc_end(dump_sdmmc_stage* stage, const dump_sdmmc_ops* ops)
+{
+    int res = 0;
+
+    if(stage->streaming) {
+        res = sdhc_stream_wait(&stage->stream, stage->pushed);
+        // a close we didn't ask for (see _dump_sdmmc_flush) may still have failed
+        if(!res && stage->stream.state == SDHC_STREAM_CLOSED) res = stage->stream.error;
+        if(res) printf("sdmmc: stream failed with %d\n", res);
+        // reported now, so the retry opens a new stream instead of failing on it
+        if(stage->stream.state == SDHC_STREAM_CLOSED) stage->stream.error = 0;
+        return res;
+    }
+
+    // everything queued has to be waited for, even after a failure
+    while(stage->waited < stage->issued) {
+        int cmd_res = ops->end(&stage->cmds[stage->waited++ % SDHC_QUEUE_DEPTH]);
+        if(cmd_res && !res) res = cmd_res;
+
+        if(!res) res = _dump_sdmmc_issue(stage, ops);
+    }
+
+    return res;
+}
+
+// Ends the stream, if it's still going; for writes, that's when the last of
+// the data is on the card for sure. Any other command on the host closes the
+// stream too, and how that went is kept in the stream for us to report here.
+// An error is only reported once, so the pipeline's retry gets a new stream.
+static int _dump_sdmmc_flush(void* ctx)
+{
+    dump_sdmmc_stage* stage = (dump_sdmmc_stage*)ctx;
+    int res = stage->stream.error;
+    if(stage->stream.state != SDHC_STREAM_CLOSED)
+        res = sdhc_stream_close(&stage->stream);
+
+    if(res) printf("sdmmc: stream failed with %d\n", res);
+    stage->stream.error = 0;
+    return res;
+}
+
+static int _dump_sdmmc_stream(dump_sdmmc_stage* stage, const dump_sdmmc_ops* ops, u32 sector, u32 size, void* buf)
+{
+    struct sdhc_stream* stream = &stage->stream;
+
+    // another stream or command on the same host closes ours
+    bool write = !(stream->cmd.c_flags & SCF_CMD_READ);
+    if(stream->state == SDHC_STREAM_CLOSED || write != ops->write || sector != stage->stream_next) {
+        int res = _dump_sdmmc_flush(stage);
+        if(res == 0) res = ops->open(sector, ops->write, stream);
+        if(res) return res;
+        stage->pushed = 0;
+    }
+
+    int res = sdhc_stream_push(stream, buf, size);
+    if(res) {
+        printf("sdmmc: stream failed with %d\n", res);
+        return res;
+    }
+
+    stage->pushed++;
+    stage->stream_next = sector + size / SDMMC_DEFAULT_BLOCKLEN;
+    return 0;
+}
+
+static int _dump_sdmmc_start(dump_sdmmc_stage* stage, const dump_sdmmc_ops* ops, u32 offset, u32 count, void* buf)
+{
+    u32 sector = stage->base + offset * stage->sectors;
+    u32 size = count * stage->sectors * SDMMC_DEFAULT_BLOCKLEN;
+
+    stage->streaming = (size % SDHC_STREAM_BOUNDARY) == 0 && ((u32)buf % SDHC_STREAM_BOUNDARY) == 0;
+    if(stage->streaming)
+        return _dump_sdmmc_stream(stage, ops, sector, size, buf);
+
+    stage->next = sector;
+    stage->left = count * stage->sectors;
+    stage->data = (u8*)buf;
+    stage->issued = stage->waited = 0;
+
+    int res = _dump_sdmmc_issue(stage, ops);
+    if(res && stage->issued) {
+        // the pipeline won't call end() for a failed start
+        stage->left = 0;
+        _dump_sdmmc_end(stage, ops);
+    }
+
+    return res;
+}
+
+static int _dump_mlc_start_read(void* ctx, u32 offset, u32 count, void* buf)
+{
+    return _dump_sdmmc_start((dump_sdmmc_stage*)ctx, &mlc_read_ops, offset, count, buf);
+}
+
+static int _dump_mlc_end_read(void* ctx)
+{
+    return _dump_sdmmc_end((dump_sdmmc_stage*)ctx, &mlc_read_ops);
+}
+
+static int _dump_sdcard_start_write(void* ctx, u32 offset, u32 count, void* buf)
+{
+    return _dump_sdmmc_start((dump_sdmmc_stage*)ctx, &sdcard_write_ops, offset, count, buf);
+}
+
+static int _dump_sdcard_end_write(void* ctx)
+{
+    return _dump_sdmmc_end((dump_sdmmc_stage*)ctx, &sdcard_write_ops);
+}
+
+static int _dump_sdcard_start_read(void* ctx, u32 offset, u32 count, void* buf)
+{
+    return _dump_sdmmc_start((dump_sdmmc_stage*)ctx, &sdcard_read_ops, offset, count, buf);
+}
+
+static int _dump_sdcard_end_read(void* ctx)
+{
+    return _dump_sdmmc_end((dump_sdmmc_stage*)ctx, &sdcard_read_ops);
+}
+
+typedef struct {
+    // PAGE_SIZE, or PAGE_SIZE + PAGE_SPARE_SIZE to put each page's spare after it (.RAW)
+    u32 stride;
+    // part of a block map pass, see nand_map_pass_begin(); only then can the map's
+    // erased hint be trusted, so verifies leave this unset and read every page
+    bool map_pass;
+    nand_ring ring;
+} dump_nand_stage;
+
+static int _dump_nand_start_read(void* ctx, u32 offset, u32 count, void* buf)
+{
+    dump_nand_stage* stage = (dump_nand_stage*)ctx;
+
+    stage->ring = (nand_ring) {
+        .pageno = offset,
+        .count = count,
+        .data = (u8*)buf,
+        .stride = stage->stride,
+        .slots = count,
+        .erased = stage->map_pass ? nand_map_pass_erased : NULL,
+    };
+    nand_ring_start(&stage->ring);
+
+    return 0;
+}
+
+static int _dump_nand_end_read(void* ctx)
+{
+    dump_nand_stage* stage = (dump_nand_stage*)ctx;
+    nand_ring* ring = &stage->ring;
+
+    for(u32 i = 0; i < ring->count; i++)
+    {
+        void* data = NULL; void* ecc = NULL;
+        int res = nand_ring_wait(ring, &data, &ecc);
+        if(stage->map_pass) nand_map_pass_page(ring->pageno + i, res, ecc);
+
+        if(stage->stride > PAGE_SIZE)
+            memcpy((u8*)data + PAGE_SIZE, ecc, PAGE_SPARE_SIZE);
+    }
+    nand_ring_stop(ring);
+
+    return 0;
+}
+
+typedef struct {
+    FIL* file;
+    u32 block_size;
+    FRESULT fres;
+} dump_file_stage;
+
+// FatFs writes are synchronous, so all the work happens here. Seeking first makes
+// a retried chunk land in the same place.
+static int _dump_file_start_write(void* ctx, u32 offset, u32 count, void* buf)
+{
+    dump_file_stage* stage = (dump_file_stage*)ctx;
+    UINT size = count * stage->block_size, btx = 0;
+
+    stage->fres = f_lseek(stage->file, offset * stage->block_size);
+    if(stage->fres == FR_OK) stage->fres = f_write(stage->file, buf, size, &btx);
+    if(stage->fres == FR_OK && btx != size) stage->fres = FR_DENIED;
+
+    return stage->fres;
+}
+
+static int _dump_file_end(void* ctx)
+{
+    return ((dump_file_stage*)ctx)->fres;
+}
+
+static int _dump_file_start_read(void* ctx, u32 offset, u32 count, void* buf)
+{
+    dump_file_stage* stage = (dump_file_stage*)ctx;
+    UINT size = count * stage->block_size, btx = 0;
+
+    stage->fres = f_lseek(stage->file, offset * stage->block_size);
+    if(stage->fres == FR_OK) stage->fres = f_read(stage->file, buf, size, &btx);
+    if(stage->fres == FR_OK && btx != size) stage->fres = FR_INT_ERR;
+
+    return stage->fres;
+}
+
+// Compressing sink: each chunk becomes LZ4 blocks of `split` pipeline blocks,
+// written after the last ones. `pos` only moves on once a chunk is written, so a
+// retried chunk overwrites its own failed attempt.
+typedef struct {
+    FIL* file;
+    u32 block_size;
+    // at most LZ4_BLOCK_MAX bytes
+    u32 split;
+    u8* out;
+    u32 pos;
+    u32 size;
+    FRESULT fres;
+} dump_lz4_stage;
+
+static FRESULT _dump_lz4_write(dump_lz4_stage* stage, u32 size)
+{
+    UINT btx = 0;
+
+    stage->fres = f_lseek(stage->file, stage->pos);
+    if(stage->fres == FR_OK) stage->fres = f_write(stage->file, stage->out, size, &btx);
+    if(stage->fres == FR_OK && btx != size) stage->fres = FR_DENIED;
+
+    stage->size = size;
+    return stage->fres;
+}
+
+static int _dump_lz4_start_write(void* ctx, u32 offset, u32 count, void* buf)
+{
+    dump_lz4_stage* stage = (dump_lz4_stage*)ctx;
+    u32 size = 0;
+    (void)offset;
+
+    for(u32 i = 0; i < count; i += stage->split) {
+        u32 blocks = min(stage->split, count - i);
+        size += lz4_frame_block((u8*)buf + i * stage->block_size, blocks * stage->block_size, stage->out + size);
+    }
+
+    return _dump_lz4_write(stage, size);
+}
+
+static int _dump_lz4_end(void* ctx)
+{
+    dump_lz4_stage* stage = (dump_lz4_stage*)ctx;
+    if(stage->fres == FR_OK) stage->pos += stage->size;
+
+    return stage->fres;
+}
+
+// Verification sink: reads the copy back from `dest` and compares it with what the
+// source just read. Mismatching ranges are reported, and rewritten through `repair`
+// if that's set.
+typedef struct {
+    const char* name;
+    pipeline_stage dest;
+    pipeline_stage repair;
+    u32 block_size;
+
+    u8* buf;
+    u8* src;
+    u32 offset;
+    u32 count;
+
+    u32 mismatched;
+    u32 run_start;
+    u32 run_count;
+} dump_verify_stage;
+
+static void _dump_verify_flush(dump_verify_stage* stage)
+{
+    if(!stage->run_count) return;
+
+    printf("%s: Mismatch at 0x%08lX-0x%08lX%s\n", stage->name, stage->run_start,
+            stage->run_start + stage->run_count - 1, stage->repair.start ? ", rewritten" : "");
+    stage->run_count = 0;
+}
+
+static int _dump_verify_start(void* ctx, u32 offset, u32 count, void* buf)
+{
+    dump_verify_stage* stage = (dump_verify_stage*)ctx;
+
+    stage->src = (u8*)buf;
+    stage->offset = offset;
+    stage->count = count;
+
+    return stage->dest.start(stage->dest.ctx, offset, count, stage->buf);
+}
+
+static int _dump_verify_end(void* ctx)
+{
+    dump_verify_stage* stage = (dump_verify_stage*)ctx;
+
+    int res = stage->dest.end(stage->dest.ctx);
+    if(res) return res;
+
+    bool bad = false;
+    for(u32 i = 0; i < stage->count; i++)
+    {
+        u32 block = stage->offset + i;
+        if(!memcmp(stage->src + i * stage->block_size, stage->buf + i * stage->block_size, stage->block_size))
+            continue;
+
+        if(stage->run_count && stage->run_start + stage->run_count != block)
+            _dump_verify_flush(stage);
+        if(!stage->run_count) stage->run_start = block;
+        stage->run_count++;
+
+        stage->mismatched++;
+        bad = true;
+    }
+
+    // the whole chunk is rewritten, it's already in memory anyway
+    if(bad && stage->repair.start) {
+        res = stage->repair.start(stage->repair.ctx, stage->offset, stage->count, stage->src);
+        if(res == 0) res = stage->repair.end(stage->repair.ctx);
+        if(res) printf("%s: Failed to rewrite 0x%08lX (%d).\n", stage->name, stage->offset, res);
+    }
+
+    return 0;
+}
+
+static int _dump_verify_flush_stages(void* ctx)
+{
+    dump_verify_stage* stage = (dump_verify_stage*)ctx;
+
+    int res = stage->dest.flush ? stage->dest.flush(stage->dest.ctx) : 0;
+    if(stage->repair.flush) {
+        int fix_res = stage->repair.flush(stage->repair.ctx);
+        if(!res) res = fix_res;
+    }
+
+    return res;
+}
+
+// Runs `pipe` (with the source already set up) against the copy read back through
+// `dest`. Returns the number of mismatching blocks, or a negative error.
+static int _dump_verify(pipeline* pipe, pipeline_stage dest, pipeline_stage repair)
+{
+    dump_verify_stage stage = {
+        .name = pipe->name,
+        .dest = dest,
+        .repair = repair,
+        .block_size = pipe->block_size,
+    };
+
+    stage.buf = memalign(PIPELINE_BUF_ALIGN, pipe->chunk * pipe->block_size);
+    if(!stage.buf) return -1;
+
+    pipe->sink = (pipeline_stage){_dump_verify_start, _dump_verify_end, &stage, _dump_verify_flush_stages};
+
+    int res = pipeline_run(pipe);
+    _dump_verify_flush(&stage);
+    free(stage.buf);
+
+    if(res) return res;
+
+    printf("%s: %s\n", pipe->name, stage.mismatched ? "Verification failed" : "Verified OK");
+    return stage.mismatched;
+}
+
+// The redNAND DATA partition holds the bookkeeping for copies, in sectors:
+//   0       the journal
+//   1-30    the MLC zero map
+//   31-     chunk hash lists for SLC, SLCCMPT and MLC, in that order
+// which is 1955 of its 2048 sectors.
+#define DATA_JOURNAL_SECTOR     (0)
+#define DATA_ZERO_MAP_SECTOR    (1)
+#define DATA_HASHES_SECTOR      (DATA_ZERO_MAP_SECTOR + ZERO_MAP_SECTORS)
+
+// redNAND copies go in chunks of 512 sectors, which the zero map and hashes count in
+#define REDNAND_MLC_CHUNK       (SDHC_BLOCK_COUNT_MAX)
+#define REDNAND_SLC_CHUNK       (SDHC_BLOCK_COUNT_MAX / (PAGE_SIZE / SDMMC_DEFAULT_BLOCKLEN))
+
+#define ZERO_MAP_CHUNKS         (TOTAL_SECTORS / REDNAND_MLC_CHUNK)
+#define ZERO_MAP_SECTORS        ((ZERO_MAP_CHUNKS / 8 + SDMMC_DEFAULT_BLOCKLEN - 1) / SDMMC_DEFAULT_BLOCKLEN)
+
+// a chunk's hash is the first 8 bytes of its SHA-1
+#define HASHES_PER_SECTOR       (SDMMC_DEFAULT_BLOCKLEN / sizeof(u64))
+#define HASH_LIST_SECTORS(chunks) (((chunks) + HASHES_PER_SECTOR - 1) / HASHES_PER_SECTOR)
+#define SLC_HASH_SECTORS        HASH_LIST_SECTORS(NAND_MAX_PAGE / REDNAND_SLC_CHUNK)
+
+// Targets are checkpointed every so often, only counting what the sink has
+// finished writing.
+#define JOURNAL_MAGIC (0x524A4E4C) // "RJNL"
+#define JOURNAL_VERSION (2)
+
+enum {
+    JOURNAL_SLC,
+    JOURNAL_SLCCMPT,
+    JOURNAL_MLC,
+    JOURNAL_TARGETS
+};
+
+typedef struct {
+    u32 magic;
+    u32 version;
+    // skip chunks whose hash matches the list
+    u32 resync;
+    dump_journal_target targets[JOURNAL_TARGETS];
+} dump_journal;
+
+static u8 journal_buf[SDMMC_DEFAULT_BLOCKLEN] ALIGNED(32);
+static dump_journal* const journal = (dump_journal*)journal_buf;
+static u32 journal_sector = 0;
+
+static int _dump_journal_load(u32 sector)
+{
+    journal_sector = sector;
+
+    int res = sdcard_read(sector + DATA_JOURNAL_SECTOR, 1, journal_buf);
+    if(res) return res;
+
+    if(journal->magic != JOURNAL_MAGIC || journal->version != JOURNAL_VERSION)
+        return -1;
+
+    return 0;
+}
+
+static int _dump_journal_save(void)
+{
+    return sdcard_write(journal_sector + DATA_JOURNAL_SECTOR, 1, journal_buf);
+}
+
+static int _dump_journal_checkpoint(void* ctx, u32 done)
+{
+    ((dump_journal_target*)ctx)->done = done;
+    return _dump_journal_save();
+}
+
+static bool _dump_journal_resumable(u32 sector)
+{
+    if(sector == 0 || _dump_journal_load(sector)) return false;
+
+    bool started = false, finished = true;
+    for(int i = 0; i < JOURNAL_TARGETS; i++) {
+        dump_journal_target* target = &journal->targets[i];
+        if(target->done) started = true;
+        if(target->done < target->total) finished = false;
+    }
+
+    return started && !finished;
+}
+
+// Whether every target has been copied in full before, so it can be resynced.
+static bool _dump_journal_synced(u32 sector)
+{
+    if(sector == 0 || _dump_journal_load(sector)) return false;
+
+    for(int i = 0; i < JOURNAL_TARGETS; i++)
+        if(!journal->targets[i].hashed) return false;
+
+    return true;
+}
+
+static void _dump_hash_tap(void* ctx, const void* buf, u32 size)
+{
+    manifest_update((manifest*)ctx, buf, size);
+}
+
+// Runs a dump pipeline, hashing what it copies into sdmc:/<name>.sha1 on the way.
+static int _dump_run_hashed(pipeline* pipe, const char* name)
+{
+    manifest sums;
+    if(manifest_init(&sums, name, (u64)pipe->start * pipe->block_size, (u64)pipe->total * pipe->block_size)) {
+        printf("%s: Not enough memory for a manifest, dumping without one.\n", name);
+        return pipeline_run(pipe);
+    }
+
+    pipe->tap = _dump_hash_tap;
+    pipe->tap_ctx = &sums;
+
+    int res = pipeline_run(pipe);
+    if(res) {
+        manifest_free(&sums);
+        return res;
+    }
+
+    // the dump itself is fine even if the manifest couldn't be written
+    manifest_finish(&sums);
+    return 0;
+}
+
+// Sink for the redNAND partitions. With a DATA partition, each chunk's hash goes
+// into a list there, and when resyncing, chunks that still match their hash are
+// already on the SD card and get skipped. MLC also keeps a bitmap of the chunks
+// that were all zeroes (the "zero map"), and in sparse mode erases those on the
+// SD card instead of writing them, which only works if the card erases to zeroes.
+static u8 zero_map[ZERO_MAP_SECTORS * SDMMC_DEFAULT_BLOCKLEN] ALIGNED(32);
+
+enum {
+    REDNAND_WRITE,
+    REDNAND_ERASE,
+    REDNAND_SKIP,
+};
+
+typedef struct {
+    dump_sdmmc_stage sdcard;
+    // pipeline blocks per chunk
+    u32 chunk;
+    bool zero_map;
+    bool sparse;
+
+    // NULL without a DATA partition
+    dump_journal_target* target;
+    u64* hashes;
+    u32 hashes_sector;
+    u32 hashes_saved;
+    bool resync;
+    // the copy's manifest, fed the hashes above so chunks are only hashed once,
+    // and the chunk it gets next
+    manifest* sums;
+    u32 sums_next;
+
+    // what happened to the chunk in flight, and its hash, which only goes
+    // into the list once the chunk is written
+    int action;
+    int res;
+    u32 index;
+    u64 hash;
+    u32 skipped;
+    u32 erased;
+} dump_rednand_stage;
+
+// `size` must be a multiple of 32 bytes.
+static bool _dump_is_zero(const void* buf, u32 size)
+{
+    const u32* p = (const u32*)buf;
+    const u32* end = p + size / sizeof(u32);
+
+    for(; p < end; p += 8)
+        if(p[0] | p[1] | p[2] | p[3] | p[4] | p[5] | p[6] | p[7]) return false;
+
+    return true;
+}
+
+static int _dump_rednand_start_write(void* ctx, u32 offset, u32 count, void* buf)
+{
+    dump_rednand_stage* stage = (dump_rednand_stage*)ctx;
+    dump_sdmmc_stage* sdcard = &stage->sdcard;
+
+    u32 chunk = offset / stage->chunk;
+    u32 size = count * sdcard->sectors * SDMMC_DEFAULT_BLOCKLEN;
+
+    stage->action = REDNAND_WRITE;
+    stage->res = 0;
+
+    if(stage->hashes) {
+        u8 digest[SHA_HASH_SIZE];
+        sha_hash(buf, digest, size);
+        memcpy(&stage->hash, digest, sizeof(stage->hash));
+        stage->index = chunk;
+
+        // a retried chunk is already in the manifest
+        if(stage->sums && chunk == stage->sums_next) {
+            manifest_update_digest(stage->sums, digest, size);
+            stage->sums_next++;
+        }
+
+        if(stage->resync && stage->hashes[chunk] == stage->hash) {
+            stage->action = REDNAND_SKIP;
+            return 0;
+        }
+    }
+
+    if(stage->zero_map) {
+        bool zero = _dump_is_zero(buf, size);
+
+        if(zero) zero_map[chunk / 8] |= 1 << (chunk % 8);
+        else zero_map[chunk / 8] &= ~(1 << (chunk % 8));
+
+        if(zero && stage->sparse) {
+            stage->action = REDNAND_ERASE;
+            stage->res = sdcard_erase(sdcard->base + offset * sdcard->sectors, count * sdcard->sectors);
+            return stage->res;
+        }
+    }
+
+    return _dump_sdcard_start_write(sdcard, offset, count, buf);
+}
+
+static int _dump_rednand_end_write(void* ctx)
+{
+    dump_rednand_stage* stage = (dump_rednand_stage*)ctx;
+    int res = 0;
+
+    switch(stage->action) {
+        case REDNAND_SKIP:
+            stage->skipped++;
+            return 0;
+        case REDNAND_ERASE:
+            res = stage->res;
+            if(res == 0) stage->erased++;
+            break;
+        default:
+            res = _dump_sdcard_end_write(&stage->sdcard);
+            break;
+    }
+
+    // until then the old hash stays, so a retry can't skip a half-written chunk
+    if(res == 0 && stage->hashes)
+        stage->hashes[stage->index] = stage->hash;
+
+    return res;
+}
+
+static int _dump_rednand_flush(void* ctx)
+{
+    return _dump_sdmmc_flush(&((dump_rednand_stage*)ctx)->sdcard);
+}
+
+// Writes out the hash list up to `chunks`, from where the last save left off.
+static int _dump_rednand_save_hashes(dump_rednand_stage* stage, u32 chunks)
+{
+    u32 first = stage->hashes_saved / HASHES_PER_SECTOR;
+    u32 last = HASH_LIST_SECTORS(chunks);
+
+    for(u32 sector = first; sector < last; sector += SDHC_BLOCK_COUNT_MAX) {
+        u32 count = min(last - sector, (u32)SDHC_BLOCK_COUNT_MAX);
+        int res = sdcard_write(journal_sector + stage->hashes_sector + sector, count,
+                               (u8*)stage->hashes + sector * SDMMC_DEFAULT_BLOCKLEN);
+        if(res) return res;
+    }
+
+    stage->hashes_saved = chunks;
+    return 0;
+}
+
+// the zero map and hashes go first, so the journal never counts chunks they don't cover
+static int _dump_rednand_checkpoint(void* ctx, u32 done)
+{
+    dump_rednand_stage* stage = (dump_rednand_stage*)ctx;
+    int res = 0;
+
+    if(stage->zero_map) {
+        res = sdcard_write(journal_sector + DATA_ZERO_MAP_SECTOR, ZERO_MAP_SECTORS, zero_map);
+        if(res) return res;
+    }
+
+    if(stage->hashes) {
+        res = _dump_rednand_save_hashes(stage, (done + stage->chunk - 1) / stage->chunk);
+        if(res) return res;
+
+        if(done == stage->target->total) stage->target->hashed = 1;
+    }
+
+    return _dump_journal_checkpoint(stage->target, done);
+}
+
+// Loads the bookkeeping for `stage->target`, which must be one of the journal's.
+static int _dump_rednand_load(dump_rednand_stage* stage)
+{
+    dump_journal_target* target = stage->target;
+    u32 chunks = (target->total + stage->chunk - 1) / stage->chunk;
+    u32 sectors = HASH_LIST_SECTORS(chunks);
+    int res = 0;
+
+    // the lists are in journal order, MLC's coming after both (equal) SLC ones
+    stage->hashes_sector = DATA_HASHES_SECTOR + (target - journal->targets) * SLC_HASH_SECTORS;
+    stage->hashes_saved = target->done / stage->chunk;
+
+    if(stage->zero_map) {
+        res = sdcard_read(journal_sector + DATA_ZERO_MAP_SECTOR, ZERO_MAP_SECTORS, zero_map);
+        if(res) return res;
+    }
+
+    stage->hashes = memalign(32, sectors * SDMMC_DEFAULT_BLOCKLEN);
+    if(!stage->hashes) {
+        // chunks are about to change without the list following along
+        printf("Not enough memory for chunk hashes, the next copy will be a full one.\n");
+        target->hashed = 0;
+        return _dump_journal_save();
+    }
+
+    for(u32 sector = 0; sector < sectors; sector += SDHC_BLOCK_COUNT_MAX) {
+        u32 count = min(sectors - sector, (u32)SDHC_BLOCK_COUNT_MAX);
+        res = sdcard_read(journal_sector + stage->hashes_sector + sector, count,
+                          (u8*)stage->hashes + sector * SDMMC_DEFAULT_BLOCKLEN);
+        if(res) {
+            free(stage->hashes);
+            stage->hashes = NULL;
+            return res;
+        }
+    }
+
+    stage->resync = journal->resync && target->hashed;
+    return 0;
+}
+
+static void _dump_print_ecc_stats(const char* name)
+{
+    nand_ecc_stats stats;
+    nand_get_ecc_stats(&stats);
+
+    printf("%s: %lu pages corrected, %lu uncorrectable\n", name, stats.corrected, stats.uncorrectable);
+    if(stats.uncorrectable)
+        printf("%s: Last uncorrectable page was 0x%05lX\n", name, stats.last_uncorrectable);
+}
+
+// One target's redNAND copy. Its setup happens in the pipeline's open() and
+// close(), so copies can also wait their turn in a lane, see _dump_copy_rednand().
+typedef struct {
+    pipeline pipe;
+    // NAND bank to read, or 0 for MLC
+    u32 bank;
+    dump_nand_stage nand;
+    dump_sdmmc_stage mlc;
+    dump_rednand_stage sink;
+
+    manifest sums;
+    bool summed;
+} dump_rednand_copy;
+
+static int _dump_rednand_open(void* ctx)
+{
+    dump_rednand_copy* copy = (dump_rednand_copy*)ctx;
+    pipeline* pipe = &copy->pipe;
+    dump_rednand_stage* stage = &copy->sink;
+    dump_journal_target* target = stage->target;
+
+    if(stage->zero_map)
+        memset(zero_map, 0, sizeof(zero_map));
+
+    if(target) {
+        int res = _dump_rednand_load(stage);
+        if(res) {
+            printf("%s: Failed to load chunk hashes (%d).\n", pipe->name, res);
+            return -1;
+        }
+        if(journal->resync && !stage->resync)
+            printf("%s: No chunk hashes from an earlier copy, copying all of it\n", pipe->name);
+
+        pipe->start = target->done;
+    }
+
+    if(copy->bank) {
+        printf("Initializing %s...\n", pipe->name);
+        nand_map_pass_begin(copy->bank);
+        nand_initialize(copy->bank);
+        nand_reset_ecc_stats();
+    }
+
+    copy->summed = manifest_init(&copy->sums, pipe->name, (u64)pipe->start * pipe->block_size,
+                                 (u64)pipe->total * pipe->block_size) == 0;
+    if(copy->summed && stage->hashes) {
+        copy->sums.chunk = pipe->chunk * pipe->block_size;
+        stage->sums = &copy->sums;
+        stage->sums_next = pipe->start / pipe->chunk;
+    } else if(copy->summed) {
+        pipe->tap = _dump_hash_tap;
+        pipe->tap_ctx = &copy->sums;
+    } else {
+        printf("%s: Not enough memory for a manifest, dumping without one.\n", pipe->name);
+    }
+
+    return 0;
+}
+
+static void _dump_rednand_close(void* ctx, int res)
+{
+    dump_rednand_copy* copy = (dump_rednand_copy*)ctx;
+    pipeline* pipe = &copy->pipe;
+    dump_rednand_stage* stage = &copy->sink;
+
+    free(stage->hashes);
+    stage->hashes = NULL;
+
+    // the dump itself is fine even if the manifest couldn't be written
+    if(copy->summed) {
+        if(res) manifest_free(&copy->sums);
+        else manifest_finish(&copy->sums);
+    }
+    if(res) {
+        if(copy->bank) nand_map_pass_cancel();
+        return;
+    }
+
+    u32 chunks = (pipe->total - pipe->start + pipe->chunk - 1) / pipe->chunk;
+    if(stage->resync)
+        printf("%s: 0x%lX of 0x%lX chunks unchanged\n", pipe->name, stage->skipped, chunks);
+    if(stage->sparse)
+        printf("%s: Erased 0x%lX zero chunks instead of writing them\n", pipe->name, stage->erased);
+
+    if(copy->bank) {
+        nand_map_pass_end();
+        _dump_print_ecc_stats(pipe->name);
+    }
+}
+
+// Sets up a copy of NAND `bank` (or MLC, for 0) to redNAND at `base`, with its
+// journal target if there is one.
+static void _dump_rednand_prepare(dump_rednand_copy* copy, u32 base, u32 bank, dump_journal_target* target, bool sparse)
+{
+    memset(copy, 0, sizeof(*copy));
+    copy->bank = bank;
+
+    pipeline* pipe = &copy->pipe;
+    *pipe = (pipeline) {
+        .name = bank ? _dump_bank_name(bank) : "MLC",
+        .sink = {_dump_rednand_start_write, _dump_rednand_end_write, &copy->sink, _dump_rednand_flush},
+        .depth = tuning_get()->depth,
+        .retries = DUMP_RETRIES,
+        .open = _dump_rednand_open,
+        .open_ctx = copy,
+        .close = _dump_rednand_close,
+        .close_ctx = copy,
+    };
+
+    if(bank) {
+        // 512 sectors a chunk is 128 pages; NAND reads the next chunk from IRQs
+        // while SD writes the last one
+        copy->nand = (dump_nand_stage) {.stride = PAGE_SIZE, .map_pass = true};
+        copy->sink = (dump_rednand_stage) {
+            .sdcard = {.base = base, .sectors = PAGE_SIZE / SDMMC_DEFAULT_BLOCKLEN},
+            .chunk = REDNAND_SLC_CHUNK,
+            .target = target,
+        };
+
+        pipe->source = (pipeline_stage) {_dump_nand_start_read, _dump_nand_end_read, &copy->nand};
+        pipe->total = NAND_MAX_PAGE;
+        pipe->block_size = PAGE_SIZE;
+        pipe->chunk = REDNAND_SLC_CHUNK;
+        pipe->checkpoint_every = 0x4000;
+    } else {
+        if(sparse && sdcard_erased_value() != 0x00) {
+            printf("SD card doesn't erase to zeroes, copying all of MLC.\n");
+            sparse = false;
+        }
+
+        // MLC and SD are two separate host controllers using DMA, so reading the next
+        // chunk from one while writing the last one to the other runs at full speed.
+        copy->mlc = (dump_sdmmc_stage) {.base = 0, .sectors = 1};
+        copy->sink = (dump_rednand_stage) {
+            .sdcard = {.base = base, .sectors = 1},
+            .chunk = REDNAND_MLC_CHUNK,
+            .zero_map = true,
+            .sparse = sparse,
+            .target = target,
+        };
+
+        pipe->source = (pipeline_stage) {_dump_mlc_start_read, _dump_mlc_end_read, &copy->mlc, _dump_sdmmc_flush};
+        pipe->total = TOTAL_SECTORS;
+        pipe->block_size = SDMMC_DEFAULT_BLOCKLEN;
+        pipe->chunk = REDNAND_MLC_CHUNK;
+        pipe->checkpoint_every = 0x20000;
+    }
+
+    if(target) {
+        pipe->checkpoint = _dump_rednand_checkpoint;
+        pipe->checkpoint_ctx = &copy->sink;
+    }
+}
+
+int _dump_mlc(u32 base, dump_journal_target* target, bool sparse)
+{
+    sdcard_ack_card();
+    if(sdcard_check_card() != SDMMC_INSERTED) {
+        printf("SD card is not initialized.\n");
+        return -1;
+    }
+
+    if(base == 0) return -2;
+
+    static dump_rednand_copy copy;
+    _dump_rednand_prepare(&copy, base, 0, target, sparse);
+
+    return pipeline_run(&copy.pipe);
+}
+
+int _dump_slc_raw(u32 bank, bool compress)
+{
+    sdcard_ack_card();
+    if(sdcard_check_card() != SDMMC_INSERTED) {
+        printf("SD card is not initialized.\n");
+        return -1;
+    }
+
+    const char* name = _dump_bank_name(bank);
+    if(!name) return -2;
+
+    char path[64] = {0};
+    sprintf(path, compress ? "%s.RAW.lz4" : "%s.RAW", name);
+
+    int res = 0;
+    FIL file = {0}; FRESULT fres = 0;
+    fres = f_open(&file, path, FA_READ | FA_WRITE | FA_CREATE_ALWAYS);
+    if(fres != FR_OK) {
+        printf("Failed to open %s (%d).\n", path, fres);
+        return -3;
+    }
+
+    printf("Initializing %s...\n", name);
+    nand_map_pass_begin(bank);
+    nand_initialize(bank);
+    nand_reset_ecc_stats();
+
+    // NAND DMAs page data straight into its place in the interleaved file layout
+    // (2112 is a multiple of 64, so every page stays aligned). Only the spare is
+    // copied in, since odd pages' spare areas aren't 128-byte aligned for the
+    // controller. Chunks are whole blocks so erased blocks can be skipped, and as
+    // many as the NAND ring holds, so it reads all of the next chunk while FatFs
+    // writes the last one (which, being whole sectors, goes out without a copy).
+    dump_nand_stage nand = {.stride = PAGE_SIZE + PAGE_SPARE_SIZE, .map_pass = true};
+    dump_file_stage fat = {.file = &file, .block_size = PAGE_SIZE + PAGE_SPARE_SIZE};
+    dump_lz4_stage lz4 = {.file = &file, .block_size = PAGE_SIZE + PAGE_SPARE_SIZE, .split = BLOCK_SIZE};
+
+    char label[16] = {0};
+    sprintf(label, "%s-RAW", name);
+
+    pipeline pipe = {
+        .name = label,
+        .source = {_dump_nand_start_read, _dump_nand_end_read, &nand},
+        .sink = {_dump_file_start_write, _dump_file_end, &fat},
+        .total = NAND_MAX_PAGE,
+        .block_size = PAGE_SIZE + PAGE_SPARE_SIZE,
+        .chunk = NAND_RING_DEPTH,
+        .depth = tuning_get()->depth,
+        .retries = DUMP_RETRIES,
+    };
+
+    // Compression runs in the sink, while the NAND ring reads the next block.
+    if(compress) {
+        lz4.out = memalign(64, (NAND_RING_DEPTH / BLOCK_SIZE) * LZ4_BLOCK_BOUND(BLOCK_SIZE * (PAGE_SIZE + PAGE_SPARE_SIZE)));
+        if(!lz4.out) {
+            printf("Not enough memory to compress %s.\n", path);
+            nand_map_pass_cancel();
+            f_close(&file);
+            return -6;
+        }
+
+        fres = _dump_lz4_write(&lz4, lz4_frame_begin(lz4.out));
+        _dump_lz4_end(&lz4);
+        if(fres != FR_OK) {
+            printf("Failed to write %s (%d).\n", path, fres);
+            free(lz4.out);
+            nand_map_pass_cancel();
+            f_close(&file);
+            return -4;
+        }
+
+        pipe.sink = (pipeline_stage){_dump_lz4_start_write, _dump_lz4_end, &lz4};
+    }
+
+    // the manifest is of the uncompressed image, so it's named after that
+    char raw[64] = {0};
+    sprintf(raw, "%s.RAW", name);
+
+    res = _dump_run_hashed(&pipe, raw);
+    if(!res && compress) {
+        fres = _dump_lz4_write(&lz4, lz4_frame_end(lz4.out));
+        _dump_lz4_end(&lz4);
+        if(fres != FR_OK) {
+            printf("Failed to write %s (%d).\n", path, fres);
+            res = -1;
+        }
+    }
+    free(lz4.out);
+
+    if(res) {
+        nand_map_pass_cancel();
+        f_close(&file);
+        return -4;
+    }
+
+    nand_map_pass_end();
+    _dump_print_ecc_stats(name);
+
+    if(compress)
+        printf("%s: Compressed to %lu MiB.\n", path, lz4.pos / (1024 * 1024));
+
+    fres = f_close(&file);
+    if(fres != FR_OK) {
+        printf("Failed to close %s (%d).\n", path, fres);
+        return -5;
+    }
+
+    return 0;
+}
+
+// Sparse SLC images (<bank>.SPR) store only pages that aren't erased, in the same
+// 2048+64 layout as <bank>.RAW, and list the erased runs in an extent index at the
+// end. The header sits in its own sector so page data stays sector aligned.
+#define SPARSE_MAGIC        0x53505253 // "SPRS"
+#define SPARSE_VERSION      1
+#define SPARSE_DATA_OFFSET  0x200
+#define SPARSE_PAGE_SIZE    (PAGE_SIZE + PAGE_SPARE_SIZE)
+
+typedef struct {
+    u32 magic;
+    u32 version;
+    u32 bank;
+    u32 page_size;
+    u32 total_pages;
+    u32 stored_pages;
+    u32 extent_count;
+    u32 extent_offset;
+} sparse_header;
+
+typedef struct {
+    u32 start;
+    u32 count;
+} sparse_extent;
+
+// worst case is every other page erased; the table is only allocated while a
+// sparse image is being written or expanded
+#define SPARSE_MAX_EXTENTS  (NAND_MAX_PAGE / 2)
+
+static bool _dump_page_erased(const void* data, const void* ecc)
+{
+    if(!nand_page_erased(ecc)) return false;
+
+    const u32* words = (const u32*)data;
+    for(int i = 0; i < PAGE_SIZE / sizeof(u32); i++)
+        if(words[i] != 0xFFFFFFFF) return false;
+
+    return true;
+}
+
+int _dump_slc_sparse(u32 bank)
+{
+    #define PAGES_PER_ITERATION (0x10)
+
+    static u8 page_buf[PAGES_PER_ITERATION][PAGE_SIZE] ALIGNED(64);
+    static u8 file_buf[PAGES_PER_ITERATION][SPARSE_PAGE_SIZE];
+    static u8 header_buf[SPARSE_DATA_OFFSET];
+
+    sdcard_ack_card();
+    if(sdcard_check_card() != SDMMC_INSERTED) {
+        printf("SD card is not initialized.\n");
+        return -1;
+    }
+
+    const char* name = _dump_bank_name(bank);
+    if(!name) return -2;
+
+    char path[64] = {0};
+    sprintf(path, "%s.SPR", name);
+
+    sparse_extent* extents = malloc(SPARSE_MAX_EXTENTS * sizeof(sparse_extent));
+    if(!extents) {
+        printf("Not enough memory for %s's extents.\n", path);
+        return -6;
+    }
+
+    int res = 0;
+    FIL file = {0}; FRESULT fres = 0; UINT btx = 0;
+    fres = f_open(&file, path, FA_READ | FA_WRITE | FA_CREATE_ALWAYS);
+    if(fres != FR_OK) {
+        free(extents);
+        printf("Failed to open %s (%d).\n", path, fres);
+        return -3;
+    }
+
+    // placeholder, the real header is written once the extents are known
+    memset(header_buf, 0, sizeof(header_buf));
+    fres = f_write(&file, header_buf, sizeof(header_buf), &btx);
+    if(fres != FR_OK || btx != sizeof(header_buf)) goto write_error;
+
+    printf("Initializing %s...\n", name);
+    nand_map_pass_begin(bank);
+    nand_initialize(bank);
+    nand_reset_ecc_stats();
+
+    nand_ring ring = {
+        .pageno = 0,
+        .count = NAND_MAX_PAGE,
+        .data = (u8*)page_buf,
+        .stride = PAGE_SIZE,
+        .slots = PAGES_PER_ITERATION,
+        .erased = nand_map_pass_erased,
+    };
+    nand_ring_start(&ring);
+
+    char label[16] = {0};
+    sprintf(label, "%s-SPR", name);
+
+    progress prog;
+    progress_begin(&prog, label, 0, (u64)NAND_MAX_PAGE * SPARSE_PAGE_SIZE);
+
+    u32 buffered = 0, stored = 0, extent_count = 0;
+    for(u32 page = 0; page < NAND_MAX_PAGE; page++)
+    {
+        void* data = NULL; void* ecc = NULL;
+        res = nand_ring_wait(&ring, &data, &ecc);
+        nand_map_pass_page(page, res, ecc);
+
+        if(_dump_page_erased(data, ecc)) {
+            sparse_extent* last = extent_count ? &extents[extent_count - 1] : NULL;
+            if(last && last->start + last->count == page) last->count++;
+            else extents[extent_count++] = (sparse_extent){page, 1};
+        } else {
+            memcpy(file_buf[buffered], data, PAGE_SIZE);
+            memcpy(file_buf[buffered] + PAGE_SIZE, ecc, PAGE_SPARE_SIZE);
+            buffered++;
+        }
+
+        nand_ring_release(&ring, 1);
+
+        if(buffered == PAGES_PER_ITERATION || (page == NAND_MAX_PAGE - 1 && buffered)) {
+            fres = f_write(&file, file_buf, buffered * SPARSE_PAGE_SIZE, &btx);
+            if(fres != FR_OK || btx != buffered * SPARSE_PAGE_SIZE) {
+                nand_ring_stop(&ring);
+                goto write_error;
+            }
+            stored += buffered;
+            buffered = 0;
+        }
+
+        progress_update(&prog, (u64)(page + 1) * SPARSE_PAGE_SIZE);
+    }
+
+    nand_ring_stop(&ring);
+    progress_end(&prog);
+    nand_map_pass_end();
+    _dump_print_ecc_stats(name);
+
+    sparse_header* header = (sparse_header*)header_buf;
+    header->magic = SPARSE_MAGIC;
+    header->version = SPARSE_VERSION;
+    header->bank = bank;
+    header->page_size = SPARSE_PAGE_SIZE;
+    header->total_pages = NAND_MAX_PAGE;
+    header->stored_pages = stored;
+    header->extent_count = extent_count;
+    header->extent_offset = SPARSE_DATA_OFFSET + stored * SPARSE_PAGE_SIZE;
+
+    UINT size = extent_count * sizeof(sparse_extent);
+    fres = f_write(&file, extents, size, &btx);
+    if(fres != FR_OK || btx != size) goto write_error;
+
+    fres = f_lseek(&file, 0);
+    if(fres == FR_OK) fres = f_write(&file, header_buf, sizeof(header_buf), &btx);
+    if(fres != FR_OK || btx != sizeof(header_buf)) goto write_error;
+    free(extents);
+
+    fres = f_close(&file);
+    if(fres != FR_OK) {
+        printf("Failed to close %s (%d).\n", path, fres);
+        return -5;
+    }
+
+    printf("%s-SPR: %lu of %lu pages stored, %lu erased extents\n", name, stored, NAND_MAX_PAGE, extent_count);
+    return 0;
+
+write_error:
+    gfx_draw_status(0, "");
+    nand_map_pass_cancel();
+    free(extents);
+    f_close(&file);
+    printf("Failed to write %s (%d).\n", path, fres);
+    return -4;
+
+    #undef PAGES_PER_ITERATION
+}
+
+int _dump_expand_sparse(u32 bank)
+{
+    #define PAGES_PER_ITERATION (0x10)
+
+    static u8 in_buf[PAGES_PER_ITERATION][SPARSE_PAGE_SIZE];
+    static u8 out_buf[PAGES_PER_ITERATION][SPARSE_PAGE_SIZE];
+
+    const char* name = _dump_bank_name(bank);
+    if(!name) return -2;
+
+    char in_path[64] = {0}, out_path[64] = {0};
+    sprintf(in_path, "%s.SPR", name);
+    sprintf(out_path, "%s.RAW", name);
+
+    FIL in = {0}, out = {0}; FRESULT fres = 0; UINT btx = 0;
+    fres = f_open(&in, in_path, FA_READ);
+    if(fres != FR_OK) {
+        printf("Failed to open %s (%d).\n", in_path, fres);
+        return -3;
+    }
+
+    sparse_header header = {0};
+    fres = f_read(&in, &header, sizeof(header), &btx);
+    if(fres != FR_OK || btx != sizeof(header) || header.magic != SPARSE_MAGIC ||
+       header.version != SPARSE_VERSION || header.bank != bank ||
+       header.page_size != SPARSE_PAGE_SIZE || header.total_pages != NAND_MAX_PAGE ||
+       header.extent_count > SPARSE_MAX_EXTENTS) {
+        f_close(&in);
+        printf("%s is not a valid sparse %s image.\n", in_path, name);
+        return -4;
+    }
+
+    UINT size = header.extent_count * sizeof(sparse_extent);
+    sparse_extent* extents = malloc(size ? size : sizeof(sparse_extent));
+    if(!extents) {
+        f_close(&in);
+        printf("Not enough memory for %s's extents.\n", in_path);
+        return -8;
+    }
+
+    fres = f_lseek(&in, header.extent_offset);
+    if(fres == FR_OK) fres = f_read(&in, extents, size, &btx);
+    if(fres == FR_OK) fres = f_lseek(&in, SPARSE_DATA_OFFSET);
+    if(fres != FR_OK || btx != size) {
+        free(extents);
+        f_close(&in);
+        printf("Failed to read %s (%d).\n", in_path, fres);
+        return -5;
+    }
+
+    fres = f_open(&out, out_path, FA_READ | FA_WRITE | FA_CREATE_ALWAYS);
+    if(fres != FR_OK) {
+        free(extents);
+        f_close(&in);
+        printf("Failed to open %s (%d).\n", out_path, fres);
+        return -3;
+    }
+
+    char label[16] = {0};
+    sprintf(label, "%s-RAW", name);
+
+    progress prog;
+    progress_begin(&prog, label, 0, (u64)NAND_MAX_PAGE * SPARSE_PAGE_SIZE);
+
+    u32 extent = 0;
+    for(u32 base = 0; base < NAND_MAX_PAGE; base += PAGES_PER_ITERATION)
+    {
+        // mark which pages of this chunk are erased, and pull in the rest
+        bool erased[PAGES_PER_ITERATION];
+        u32 present = 0;
+        for(u32 i = 0; i < PAGES_PER_ITERATION; i++) {
+            u32 page = base + i;
+            while(extent < header.extent_count &&
+                  extents[extent].start + extents[extent].count <= page)
+                extent++;
+            erased[i] = extent < header.extent_count && extents[extent].start <= page;
+            if(!erased[i]) present++;
+        }
+
+        fres = f_read(&in, in_buf, present * SPARSE_PAGE_SIZE, &btx);
+        if(fres != FR_OK || btx != present * SPARSE_PAGE_SIZE) {
+            gfx_draw_status(0, "");
+            printf("Failed to read %s (%d).\n", in_path, fres);
+            free(extents);
+            f_close(&in); f_close(&out);
+            return -5;
+        }
+
+        for(u32 i = 0, j = 0; i < PAGES_PER_ITERATION; i++) {
+            if(erased[i]) memset(out_buf[i], 0xFF, SPARSE_PAGE_SIZE);
+            else memcpy(out_buf[i], in_buf[j++], SPARSE_PAGE_SIZE);
+        }
+
+        fres = f_write(&out, out_buf, sizeof(out_buf), &btx);
+        if(fres != FR_OK || btx != sizeof(out_buf)) {
+            gfx_draw_status(0, "");
+            printf("Failed to write %s (%d).\n", out_path, fres);
+            free(extents);
+            f_close(&in); f_close(&out);
+            return -6;
+        }
+
+        progress_update(&prog, (u64)(base + PAGES_PER_ITERATION) * SPARSE_PAGE_SIZE);
+    }
+    progress_end(&prog);
+    free(extents);
+
+    f_close(&in);
+    fres = f_close(&out);
+    if(fres != FR_OK) {
+        printf("Failed to close %s (%d).\n", out_path, fres);
+        return -7;
+    }
+
+    return 0;
+
+    #undef PAGES_PER_ITERATION
+}
+
+// Compares a block on the chip with its .RAW image: data after ECC correction,
+// spare as read.
+static bool _dump_block_matches(u32 block, const u8* image)
+{
+    static u8 check_buf[BLOCK_SIZE][PAGE_SIZE] ALIGNED(64);
+
+    nand_ring ring = {
+        .pageno = block * BLOCK_SIZE,
+        .count = BLOCK_SIZE,
+        .data = (u8*)check_buf,
+        .stride = PAGE_SIZE,
+        .slots = BLOCK_SIZE,
+    };
+    bool match = true;
+
+    nand_ring_start(&ring);
+    for(u32 page = 0; page < BLOCK_SIZE && match; page++)
+    {
+        void* data = NULL; void* ecc = NULL;
+        int res = nand_ring_wait(&ring, &data, &ecc);
+
+        const u8* raw = image + page * (PAGE_SIZE + PAGE_SPARE_SIZE);
+        if(res == NAND_ECC_UNCORRECTABLE || memcmp(data, raw, PAGE_SIZE) ||
+           memcmp(ecc, raw + PAGE_SIZE, PAGE_SPARE_SIZE))
+            match = false;
+    }
+    nand_ring_stop(&ring);
+
+    return match;
+}
+
+int _dump_restore_slc(u32 bank)
+{
+    #define RAW_BLOCK_SIZE (BLOCK_SIZE * (PAGE_SIZE + PAGE_SPARE_SIZE))
+
+    // two blocks, so the next one is read from SD while NAND programs the current one
+    static u8 image_buf[2][RAW_BLOCK_SIZE] ALIGNED(64);
+
+    sdcard_ack_card();
+    if(sdcard_check_card() != SDMMC_INSERTED) {
+        printf("SD card is not initialized.\n");
+        return -1;
+    }
+
+    const char* name = _dump_bank_name(bank);
+    if(!name) return -2;
+
+    char path[64] = {0};
+    sprintf(path, "%s.RAW", name);
+
+    int res = 0;
+    FIL file = {0}; FRESULT fres = 0; UINT btx = 0;
+    fres = f_open(&file, path, FA_READ);
+    if(fres != FR_OK) {
+        printf("Failed to open %s (%d).\n", path, fres);
+        return -3;
+    }
+
+    if(f_size(&file) != NAND_MAX_BLOCK * RAW_BLOCK_SIZE) {
+        f_close(&file);
+        printf("%s is not a full %s image.\n", path, name);
+        return -4;
+    }
+
+    printf("Initializing %s...\n", name);
+    // loading the block map reads the chip ID, so do it before initializing
+    nand_map_get(bank, 0);
+    nand_initialize(bank);
+
+    u32 first = (nand_get_min_page() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    printf("%s: Leaving pages below 0x%05lX untouched\n", name, first * BLOCK_SIZE);
+
+    fres = f_lseek(&file, first * RAW_BLOCK_SIZE);
+    if(fres == FR_OK) fres = f_read(&file, image_buf[first & 1], RAW_BLOCK_SIZE, &btx);
+    if(fres != FR_OK || btx != RAW_BLOCK_SIZE) goto read_error;
+
+    progress status;
+    progress_begin(&status, name, (u64)first * RAW_BLOCK_SIZE, (u64)NAND_MAX_BLOCK * RAW_BLOCK_SIZE);
+
+    u32 programmed = 0, matched = 0, bad = 0, failed = 0;
+    for(u32 block = first; block < NAND_MAX_BLOCK; block++)
+    {
+        u8* image = image_buf[block & 1];
+        nand_program prog = {
+            .pageno = block * BLOCK_SIZE,
+            .data = image,
+            .stride = PAGE_SIZE + PAGE_SPARE_SIZE,
+        };
+        bool busy = false;
+
+        // leave bad blocks alone, whether the chip or the image says so
+        if(nand_map_get(bank, block) == NAND_BLOCK_BAD || image[PAGE_SIZE] != 0xFF)
+            bad++;
+        else if(_dump_block_matches(block, image))
+            matched++;
+        else if(nand_program_start(&prog) == 0)
+            busy = true;
+        else
+            failed++;
+
+        if(block + 1 < NAND_MAX_BLOCK) {
+            fres = f_read(&file, image_buf[(block + 1) & 1], RAW_BLOCK_SIZE, &btx);
+            if(fres != FR_OK || btx != RAW_BLOCK_SIZE) {
+                if(busy) nand_program_wait(&prog);
+                goto read_error;
+            }
+        }
+
+        if(busy) {
+            res = nand_program_wait(&prog);
+            if(res || !_dump_block_matches(block, image)) {
+                printf("%s: Block 0x%03lX failed to verify\n", name, block);
+                nand_map_set(bank, block, NAND_BLOCK_UNKNOWN);
+                failed++;
+            } else {
+                nand_map_set(bank, block, prog.pages ? NAND_BLOCK_GOOD : NAND_BLOCK_ERASED);
+                programmed++;
+            }
+        }
+
+        progress_update(&status, (u64)(block + 1) * RAW_BLOCK_SIZE);
+    }
+    progress_end(&status);
+
+    f_close(&file);
+    nand_map_save(bank);
+
+    printf("%s: %lu blocks programmed, %lu already matched, %lu bad, %lu failed\n",
+            name, programmed, matched, bad, failed);
+
+    return failed ? -6 : 0;
+
+read_error:
+    gfx_draw_status(0, "");
+    f_close(&file);
+    printf("Failed to read %s (%d).\n", path, fres);
+    return -5;
+
+    #undef RAW_BLOCK_SIZE
+}
+
+// MLC restore stages. With `compare` set, the source reads each chunk back from
+// MLC alongside the SD read (separate hosts, so the two overlap), and the sink
+// only writes chunks that differ, trading a (faster) read for the write and the
+// wear. Reads and writes share the MLC host, so a chunk that does get written
+// still waits for the next one's compare read, and the other way round.
+typedef struct {
+    dump_sdmmc_stage sdcard;
+    dump_sdmmc_stage check_mlc;
+    dump_sdmmc_stage mlc;
+    bool compare;
+    u8* check;
+
+    // what the source is reading, and whether each chunk in flight matched
+    u8* buf;
+    u32 offset;
+    u32 count;
+    bool same[PIPELINE_MAX_DEPTH];
+
+    bool skip;
+    u32 skipped;
+} dump_mlc_restore_stage;
+
+static bool* _dump_mlc_restore_same(dump_mlc_restore_stage* stage, u32 offset)
+{
+    return &stage->same[(offset / REDNAND_MLC_CHUNK) % PIPELINE_MAX_DEPTH];
+}
+
+static int _dump_mlc_restore_start_read(void* ctx, u32 offset, u32 count, void* buf)
+{
+    dump_mlc_restore_stage* stage = (dump_mlc_restore_stage*)ctx;
+
+    stage->buf = (u8*)buf;
+    stage->offset = offset;
+    stage->count = count;
+    *_dump_mlc_restore_same(stage, offset) = false;
+
+    int res = _dump_sdcard_start_read(&stage->sdcard, offset, count, buf);
+    if(res || !stage->compare) return res;
+
+    res = _dump_sdmmc_start(&stage->check_mlc, &mlc_read_ops, offset, count, stage->check);
+    // the pipeline won't call end() for a failed start
+    if(res) _dump_sdcard_end_read(&stage->sdcard);
+    return res;
+}
+
+static int _dump_mlc_restore_end_read(void* ctx)
+{
+    dump_mlc_restore_stage* stage = (dump_mlc_restore_stage*)ctx;
+
+    int res = _dump_sdcard_end_read(&stage->sdcard);
+    if(!stage->compare) return res;
+
+    int check_res = _dump_sdmmc_end(&stage->check_mlc, &mlc_read_ops);
+    if(res) return res;
+    if(check_res) return check_res;
+
+    *_dump_mlc_restore_same(stage, stage->offset) =
+        !memcmp(stage->check, stage->buf, stage->count * stage->sdcard.sectors * SDMMC_DEFAULT_BLOCKLEN);
+    return 0;
+}
+
+static int _dump_mlc_restore_flush_read(void* ctx)
+{
+    dump_mlc_restore_stage* stage = (dump_mlc_restore_stage*)ctx;
+
+    int res = _dump_sdmmc_flush(&stage->sdcard);
+    int check_res = _dump_sdmmc_flush(&stage->check_mlc);
+    return res ? res : check_res;
+}
+
+static int _dump_mlc_restore_start_write(void* ctx, u32 offset, u32 count, void* buf)
+{
+    dump_mlc_restore_stage* stage = (dump_mlc_restore_stage*)ctx;
+
+    stage->skip = stage->compare && *_dump_mlc_restore_same(stage, offset);
+    if(stage->skip) return 0;
+
+    return _dump_sdmmc_start(&stage->mlc, &mlc_write_ops, offset, count, buf);
+}
+
+static int _dump_mlc_restore_end_write(void* ctx)
+{
+    dump_mlc_restore_stage* stage = (dump_mlc_restore_stage*)ctx;
+    if(stage->skip) {
+        stage->skipped++;
+        return 0;
+    }
+
+    return _dump_sdmmc_end(&stage->mlc, &mlc_write_ops);
+}
+
+static int _dump_mlc_restore_flush_write(void* ctx)
+{
+    return _dump_sdmmc_flush(&((dump_mlc_restore_stage*)ctx)->mlc);
+}
+
+int _dump_restore_mlc(u32 mlc_base, u32 data_base, bool compare)
+{
+    sdcard_ack_card();
+    if(sdcard_check_card() != SDMMC_INSERTED) {
+        printf("SD card is not initialized.\n");
+        return -1;
+    }
+
+    if(mlc_base == 0) return -2;
+
+    // don't put a half-copied redNAND on the console
+    if(data_base && _dump_journal_load(data_base) == 0) {
+        dump_journal_target* target = &journal->targets[JOURNAL_MLC];
+        if(target->base != mlc_base || target->done < target->total) {
+            printf("redNAND MLC was never copied in full, refusing to restore it.\n");
+            return -3;
+        }
+    } else {
+        printf("No redNAND journal, assuming MLC was copied in full.\n");
+    }
+
+    // the reverse of _dump_mlc(): SD reads the next chunk while MLC writes the last
+    dump_mlc_restore_stage mlc = {
+        .sdcard = {.base = mlc_base, .sectors = 1},
+        .check_mlc = {.base = 0, .sectors = 1},
+        .mlc = {.base = 0, .sectors = 1},
+        .compare = compare,
+    };
+
+    if(compare) {
+        mlc.check = memalign(PIPELINE_BUF_ALIGN, REDNAND_MLC_CHUNK * SDMMC_DEFAULT_BLOCKLEN);
+        if(!mlc.check) {
+            printf("Not enough memory to compare, writing everything.\n");
+            mlc.compare = false;
+        }
     }
-    fwrite(&seeprom, 1, sizeof(seeprom_t), f_eep);
-    fclose(f_eep);
 
-    printf("\nDone!\n");
-ret:
-    printf("Press POWER or EJECT to return...\n");
-    smc_wait_events(SMC_POWER_BUTTON | SMC_EJECT_BUTTON);
+    pipeline pipe = {
+        .name = "MLC",
+        .source = {_dump_mlc_restore_start_read, _dump_mlc_restore_end_read, &mlc, _dump_mlc_restore_flush_read},
+        .sink = {_dump_mlc_restore_start_write, _dump_mlc_restore_end_write, &mlc, _dump_mlc_restore_flush_write},
+        .total = TOTAL_SECTORS,
+        .block_size = SDMMC_DEFAULT_BLOCKLEN,
+        .chunk = REDNAND_MLC_CHUNK,
+        .depth = tuning_get()->depth,
+        .retries = DUMP_RETRIES,
+    };
+
+    int res = pipeline_run(&pipe);
+    free(mlc.check);
+    if(res) return -4;
+
+    if(mlc.compare)
+        printf("MLC: 0x%lX of 0x%lX chunks were already identical\n", mlc.skipped, TOTAL_SECTORS / REDNAND_MLC_CHUNK);
+
+    return 0;
 }
 
-int _dump_mlc(u32 base)
+// Calibration times a MLC to SD copy like redNAND's with each candidate depth,
+// writing into a scratch file on the SD card, and keeps the fastest.
+#define CALIBRATE_DIR       "minute"
+#define CALIBRATE_PATH      "minute/tuning.tmp"
+#define CALIBRATE_SECTORS   (0x8000) // 16 MiB per candidate
+
+static const u32 calibrate_depths[] = {2, 3, 4};
+
+int _dump_calibrate(void)
 {
     sdcard_ack_card();
     if(sdcard_check_card() != SDMMC_INSERTED) {
@@ -118,212 +1771,278 @@ int _dump_mlc(u32 base)
         return -1;
     }
 
-    int res = 0, mres = 0, sres = 0;
-    if(base == 0) return -2;
+    f_mkdir(CALIBRATE_DIR);
 
-    // This uses "async" read/write functions, combined with double buffering to achieve a
-    // much faster dump. This works because these are two separate host controllers using DMA.
-    // Instead of running a single command and waiting for completion, we queue both commands
-    // and then wait for them both to complete at the end of each iteration.
-    struct sdmmc_command mlc_cmd = {0}, sdcard_cmd = {0};
+    FIL file = {0}; FRESULT fres = 0;
+    fres = f_open(&file, CALIBRATE_PATH, FA_READ | FA_WRITE | FA_CREATE_ALWAYS);
+    if(fres != FR_OK) {
+        printf("Failed to open %s (%d).\n", CALIBRATE_PATH, fres);
+        return -2;
+    }
 
-    u8* sector_buf1 = memalign(32, SDMMC_DEFAULT_BLOCKLEN * SDHC_BLOCK_COUNT_MAX);
-    u8* sector_buf2 = memalign(32, SDMMC_DEFAULT_BLOCKLEN * SDHC_BLOCK_COUNT_MAX);
+    // seeking past the end allocates the file, which has to be contiguous since
+    // it's written by sector
+    DWORD clmt[4] = {sizeof(clmt) / sizeof(clmt[0])};
+    fres = f_lseek(&file, CALIBRATE_SECTORS * SDMMC_DEFAULT_BLOCKLEN);
+    if(fres == FR_OK && f_tell(&file) != CALIBRATE_SECTORS * SDMMC_DEFAULT_BLOCKLEN) fres = FR_DENIED;
+    if(fres == FR_OK) fres = f_sync(&file);
+    if(fres == FR_OK) {
+        file.cltbl = clmt;
+        fres = f_lseek(&file, CREATE_LINKMAP);
+        file.cltbl = NULL;
+    }
 
-    u8* mlc_buf = sector_buf2;
-    u8* sdcard_buf = sector_buf1;
+    int res = 0;
+    if(fres == FR_NOT_ENOUGH_CORE) {
+        printf("%s isn't contiguous, free up some space on the SD card.\n", CALIBRATE_PATH);
+        res = -3;
+        goto out;
+    }
+    if(fres != FR_OK) {
+        printf("Failed to allocate %s (%d).\n", CALIBRATE_PATH, fres);
+        res = -3;
+        goto out;
+    }
 
-    // Fill one of the buffers in advance, so SD card has something to work with.
-    do res = mlc_read(0, SDHC_BLOCK_COUNT_MAX, sdcard_buf);
-    while(res);
+    u32 base = file.fs->database + file.fs->csize * (clmt[2] - 2);
+    const tuning_params previous = *tuning_get();
+    tuning_params best = previous;
+    u64 best_ticks = ~0ull;
 
-    // Do one less iteration than we need, due to having to special case the start and end.
-    u32 sdcard_sector = base;
-    for(u32 sector = 0; sector < (TOTAL_SECTORS - SDHC_BLOCK_COUNT_MAX); sector += SDHC_BLOCK_COUNT_MAX)
+    for(int i = 0; i < sizeof(calibrate_depths) / sizeof(calibrate_depths[0]); i++)
     {
-        int complete = 0;
-        // Make sure to retry until the command succeeded, probably superfluous but harmless...
-        while(complete != 0b11) {
-            // Issue commands if we didn't already complete them.
-            if(!(complete & 0b01))
-                mres = mlc_start_read(sector + SDHC_BLOCK_COUNT_MAX, SDHC_BLOCK_COUNT_MAX, mlc_buf, &mlc_cmd);
-            if(!(complete & 0b10))
-                sres = sdcard_start_write(sdcard_sector, SDHC_BLOCK_COUNT_MAX, sdcard_buf, &sdcard_cmd);
-
-            // Only end the command if starting it succeeded.
-            // If starting and ending the command succeeds, mark it as complete.
-            if(!(complete & 0b01) && mres == 0) {
-                mres = mlc_end_read(&mlc_cmd);
-                if(mres == 0) complete |= 0b01;
-            }
-            if(!(complete & 0b10) && sres == 0) {
-                sres = sdcard_end_write(&sdcard_cmd);
-                if(sres == 0) complete |= 0b10;
-            }
-        }
+        tuning_params params = {.depth = calibrate_depths[i]};
+        tuning_set(&params);
+
+        char label[32] = {0};
+        sprintf(label, "%lu buffers", params.depth);
+
+        dump_sdmmc_stage mlc = {.base = 0, .sectors = 1};
+        dump_sdmmc_stage sdcard = {.base = base, .sectors = 1};
+
+        pipeline pipe = {
+            .name = label,
+            .source = {_dump_mlc_start_read, _dump_mlc_end_read, &mlc, _dump_sdmmc_flush},
+            .sink = {_dump_sdcard_start_write, _dump_sdcard_end_write, &sdcard, _dump_sdmmc_flush},
+            .total = CALIBRATE_SECTORS,
+            .block_size = SDMMC_DEFAULT_BLOCKLEN,
+            .chunk = REDNAND_MLC_CHUNK,
+            .depth = params.depth,
+            .retries = DUMP_RETRIES,
+        };
+
+        u32 start = progress_stamp();
+        res = pipeline_run(&pipe);
+        u32 ticks = progress_stamp() - start;
 
-        // Swap buffers.
-        if(mlc_buf == sector_buf1) {
-            mlc_buf = sector_buf2;
-            sdcard_buf = sector_buf1;
-        } else {
-            mlc_buf = sector_buf1;
-            sdcard_buf = sector_buf2;
+        if(res) {
+            tuning_set(&previous);
+            res = -4;
+            goto out;
         }
 
-        sdcard_sector += SDHC_BLOCK_COUNT_MAX;
-
-        if((sector % 0x10000) == 0) {
-            printf("MLC: Sector 0x%08lX completed\n", sector);
+        if(ticks < best_ticks) {
+            best = params;
+            best_ticks = ticks;
         }
     }
 
-    // Finish up the last iteration.
-    do res = sdcard_write(sdcard_sector, SDHC_BLOCK_COUNT_MAX, sdcard_buf);
-    while(res);
-
-    free(sector_buf1);
-    free(sector_buf2);
+    printf("Fastest: %lu buffers\n", best.depth);
+    if(tuning_save(&best)) {
+        tuning_set(&previous);
+        res = -5;
+    }
 
-    return 0;
+out:
+    f_close(&file);
+    f_unlink(CALIBRATE_PATH);
+    return res;
 }
 
-int _dump_slc_raw(u32 bank)
+int _dump_slc(u32 base, u32 bank, dump_journal_target* target)
 {
-    #define PAGES_PER_ITERATION (0x10)
-    #define TOTAL_ITERATIONS (NAND_MAX_PAGE / PAGES_PER_ITERATION)
+    sdcard_ack_card();
+    if(sdcard_check_card() != SDMMC_INSERTED) {
+        printf("SD card is not initialized.\n");
+        return -1;
+    }
+
+    if(base == 0) return -2;
+    if(!_dump_bank_name(bank)) return -3;
 
-    static u8 page_buf[PAGE_SIZE] ALIGNED(64);
-    static u8 ecc_buf[ECC_BUFFER_ALLOC] ALIGNED(128);
+    static dump_rednand_copy copy;
+    _dump_rednand_prepare(&copy, base, bank, target, false);
 
-    static u8 file_buf[PAGES_PER_ITERATION][PAGE_SIZE + PAGE_SPARE_SIZE];
+    if(pipeline_run(&copy.pipe)) return -4;
+    return 0;
+}
 
+int _dump_copy_rednand(u32 slc_base, u32 slccmpt_base, u32 mlc_base, u32 data_base, dump_copy_mode mode, bool sparse)
+{
     sdcard_ack_card();
     if(sdcard_check_card() != SDMMC_INSERTED) {
         printf("SD card is not initialized.\n");
         return -1;
     }
 
-    const char* name = NULL;
-    switch(bank) {
-        case NAND_BANK_SLC: name = "SLC"; break;
-        case NAND_BANK_SLCCMPT: name = "SLCCMPT"; break;
-        default: return -2;
+    if(slc_base == 0 && slccmpt_base == 0 && mlc_base == 0) {
+        return -2;
     }
 
-    char path[64] = {0};
-    sprintf(path, "%s.RAW", name);
+    const struct {
+        const char* name;
+        u32 base;
+        u32 total;
+    } targets[JOURNAL_TARGETS] = {
+        [JOURNAL_SLC] = {"SLC", slc_base, NAND_MAX_PAGE},
+        [JOURNAL_SLCCMPT] = {"SLCCMPT", slccmpt_base, NAND_MAX_PAGE},
+        [JOURNAL_MLC] = {"MLC", mlc_base, TOTAL_SECTORS},
+    };
+
+    // Without a DATA partition there's nowhere to journal to, so just copy.
+    bool journaled = data_base != 0;
+    if(journaled) {
+        journal_sector = data_base;
+        bool valid = mode != DUMP_COPY_FULL && _dump_journal_load(data_base) == 0;
+        if(!valid) {
+            memset(journal_buf, 0, sizeof(journal_buf));
+            journal->magic = JOURNAL_MAGIC;
+            journal->version = JOURNAL_VERSION;
+        }
 
-    FIL file = {0}; FRESULT fres = 0; UINT btx = 0;
-    fres = f_open(&file, path, FA_READ | FA_WRITE | FA_CREATE_ALWAYS);
-    if(fres != FR_OK) {
-        printf("Failed to open %s (%d).\n", path, fres);
-        return -3;
+        // a resumed copy carries on the way it started
+        if(mode != DUMP_COPY_RESUME)
+            journal->resync = mode == DUMP_COPY_RESYNC;
+
+        // anything that moved since the journal was written starts over
+        for(int i = 0; i < JOURNAL_TARGETS; i++) {
+            dump_journal_target* target = &journal->targets[i];
+            if(target->base != targets[i].base || target->total != targets[i].total) {
+                target->base = targets[i].base;
+                target->total = targets[i].total;
+                target->done = 0;
+                target->hashed = 0;
+            } else if(mode == DUMP_COPY_RESYNC) {
+                target->done = 0;
+            }
+        }
+
+        if(_dump_journal_save()) {
+            printf("Failed to write redNAND journal.\n");
+            return -3;
+        }
     }
 
-    printf("Initializing %s...\n", name);
-    nand_initialize(bank);
+    // NAND and MLC are separate controllers, so SLC and SLCCMPT (one after the
+    // other, as they share NAND) copy side by side with MLC, taking turns to
+    // write to the SD card, and MLC being by far the biggest hides them. The
+    // partitions aren't next to each other, so each turn ends one SD stream and
+    // opens another; turns are PIPELINE_LANE_TURN chunks to keep that rare.
+    static dump_rednand_copy copies[JOURNAL_TARGETS];
+    pipeline* lanes[2] = {NULL, NULL};
+    pipeline** tails[2] = {&lanes[0], &lanes[1]};
 
-    for(u32 i = 0; i < TOTAL_ITERATIONS; i++)
+    for(int i = 0; i < JOURNAL_TARGETS; i++)
     {
-        u32 page_base = i * PAGES_PER_ITERATION;
-        for(u32 page = 0; page < PAGES_PER_ITERATION; page++)
-        {
-            nand_read_page(page_base + page, page_buf, ecc_buf);
-            nand_wait();
-            nand_correct(page_base + page, page_buf, ecc_buf);
+        if(targets[i].base == 0) continue;
 
-            memcpy(file_buf[page], page_buf, PAGE_SIZE);
-            memcpy(file_buf[page] + PAGE_SIZE, ecc_buf, PAGE_SPARE_SIZE);
+        dump_journal_target* target = journaled ? &journal->targets[i] : NULL;
+        if(target && target->done >= target->total) {
+            printf("%s: Already copied, skipping\n", targets[i].name);
+            continue;
         }
+        if(target && target->done)
+            printf("%s: Resuming at 0x%08lX\n", targets[i].name, target->done);
 
-        fres = f_write(&file, file_buf, sizeof(file_buf), &btx);
-        if(fres != FR_OK || btx != sizeof(file_buf)) {
-            f_close(&file);
-            printf("Failed to write %s (%d).\n", path, fres);
-            return -4;
+        u32 bank = 0;
+        switch(i) {
+            case JOURNAL_SLC: bank = NAND_BANK_SLC; break;
+            case JOURNAL_SLCCMPT: bank = NAND_BANK_SLCCMPT; break;
         }
+        _dump_rednand_prepare(&copies[i], targets[i].base, bank, target, sparse);
 
-        if((i % 0x100) == 0) {
-            printf("%s-RAW: Page 0x%05lX completed\n", name, page_base);
-        }
+        int lane = bank ? 0 : 1;
+        *tails[lane] = &copies[i].pipe;
+        tails[lane] = &copies[i].pipe.next;
     }
 
-    fres = f_close(&file);
-    if(fres != FR_OK) {
-        printf("Failed to close %s (%d).\n", path, fres);
-        return -5;
+    u32 count = 0;
+    for(int i = 0; i < 2; i++)
+        if(lanes[i]) lanes[count++] = lanes[i];
+
+    int res = pipeline_run_lanes(lanes, count);
+    if(res) {
+        printf("Failed to copy redNAND (%d).\n", res);
+        return -4;
     }
 
     return 0;
-
-    #undef PAGES_PER_ITERATION
-    #undef TOTAL_ITERATIONS
 }
 
-int _dump_slc(u32 base, u32 bank)
+int _dump_verify_rednand(u32 slc_base, u32 slccmpt_base, u32 mlc_base, bool repair)
 {
-    // how many sectors needed for a page (4)
-    #define SECTORS_PER_PAGE (PAGE_SIZE / SDMMC_DEFAULT_BLOCKLEN)
-    // the SD host controller can only transfer 512 sectors at a time (512*512 bytes)
-    #define SECTORS_PER_ITERATION (SDHC_BLOCK_COUNT_MAX)
-    // given the above constraint, the max number of SLC pages we can transfer to SD at a time (128)
-    #define PAGES_PER_ITERATION (SECTORS_PER_ITERATION / SECTORS_PER_PAGE)
-    // the number of SD transfer iterations required to complete the SLC dump (0x800)
-    #define TOTAL_ITERATIONS (NAND_MAX_PAGE / PAGES_PER_ITERATION)
-
-    static u8 page_buf[PAGES_PER_ITERATION][PAGE_SIZE] ALIGNED(64);
-    static u8 ecc_buf[ECC_BUFFER_ALLOC] ALIGNED(128);
-
     sdcard_ack_card();
     if(sdcard_check_card() != SDMMC_INSERTED) {
         printf("SD card is not initialized.\n");
         return -1;
     }
 
-    int res = 0;
-    if(base == 0) return -2;
-
-    const char* name = NULL;
-    switch(bank) {
-        case NAND_BANK_SLC: name = "SLC"; break;
-        case NAND_BANK_SLCCMPT: name = "SLCCMPT"; break;
-        default: return -3;
-    }
-
-    printf("Initializing %s...\n", name);
-    nand_initialize(bank);
-
-    u32 sdcard_sector = base;
-    for(u32 i = 0; i < TOTAL_ITERATIONS; i++)
+    const struct {
+        const char* name;
+        u32 base;
+        u32 bank;
+    } targets[] = {
+        {"SLC", slc_base, NAND_BANK_SLC},
+        {"SLCCMPT", slccmpt_base, NAND_BANK_SLCCMPT},
+        {"MLC", mlc_base, 0},
+    };
+
+    int mismatched = 0;
+    for(int i = 0; i < sizeof(targets) / sizeof(targets[0]); i++)
     {
-        u32 page_base = i * PAGES_PER_ITERATION;
-        for(u32 page = 0; page < PAGES_PER_ITERATION; page++)
-        {
-            nand_read_page(page_base + page, page_buf[page], ecc_buf);
-            nand_wait();
-            nand_correct(page_base + page, page_buf[page], ecc_buf);
+        if(targets[i].base == 0) continue;
+
+        // same layout as the copy: MLC sectors or SLC pages, read side by side with SD
+        dump_sdmmc_stage mlc = {.base = 0, .sectors = 1};
+        dump_nand_stage nand = {.stride = PAGE_SIZE};
+        dump_sdmmc_stage sdcard = {.base = targets[i].base, .sectors = 1};
+
+        pipeline pipe = {
+            .name = targets[i].name,
+            .depth = tuning_get()->depth,
+            .retries = DUMP_RETRIES,
+        };
+
+        if(targets[i].bank) {
+            nand_initialize(targets[i].bank);
+            sdcard.sectors = PAGE_SIZE / SDMMC_DEFAULT_BLOCKLEN;
+            pipe.source = (pipeline_stage){_dump_nand_start_read, _dump_nand_end_read, &nand};
+            pipe.total = NAND_MAX_PAGE;
+            pipe.block_size = PAGE_SIZE;
+            pipe.chunk = SDHC_BLOCK_COUNT_MAX / sdcard.sectors;
+        } else {
+            pipe.source = (pipeline_stage){_dump_mlc_start_read, _dump_mlc_end_read, &mlc, _dump_sdmmc_flush};
+            pipe.total = TOTAL_SECTORS;
+            pipe.block_size = SDMMC_DEFAULT_BLOCKLEN;
+            pipe.chunk = SDHC_BLOCK_COUNT_MAX;
         }
 
-        do res = sdcard_write(sdcard_sector, SECTORS_PER_ITERATION, page_buf);
-        while(res);
+        pipeline_stage dest = {_dump_sdcard_start_read, _dump_sdcard_end_read, &sdcard, _dump_sdmmc_flush};
+        pipeline_stage fix = {0};
+        if(repair) fix = (pipeline_stage){_dump_sdcard_start_write, _dump_sdcard_end_write, &sdcard, _dump_sdmmc_flush};
 
-        sdcard_sector += SECTORS_PER_ITERATION;
-
-        if((i % 0x100) == 0) {
-            printf("%s: Page 0x%05lX completed\n", name, page_base);
+        int res = _dump_verify(&pipe, dest, fix);
+        if(res < 0) {
+            printf("Failed to verify %s (%d).\n", targets[i].name, res);
+            return -2;
         }
+        mismatched += res;
     }
 
-    return 0;
-
-    #undef SECTORS_PER_PAGE
-    #undef SECTORS_PER_ITERATION
-    #undef PAGES_PER_ITERATION
-    #undef TOTAL_ITERATIONS
+    return mismatched;
 }
 
-int _dump_copy_rednand(u32 slc_base, u32 slccmpt_base, u32 mlc_base)
+int _dump_verify_slc_raw(u32 bank, bool repair)
 {
     sdcard_ack_card();
     if(sdcard_check_card() != SDMMC_INSERTED) {
@@ -331,26 +2050,54 @@ int _dump_copy_rednand(u32 slc_base, u32 slccmpt_base, u32 mlc_base)
         return -1;
     }
 
-    if(slc_base == 0 && slccmpt_base == 0 && mlc_base == 0) {
-        return -2;
-    }
+    const char* name = _dump_bank_name(bank);
+    if(!name) return -2;
 
-    // Dump SLC.
-    if(slc_base != 0) {
-        _dump_slc(slc_base, NAND_BANK_SLC);
-    }
+    char path[64] = {0};
+    sprintf(path, "%s.RAW", name);
 
-    // Dump SLCCMPT.
-    if(slccmpt_base != 0) {
-        _dump_slc(slccmpt_base, NAND_BANK_SLCCMPT);
+    FIL file = {0}; FRESULT fres = 0;
+    fres = f_open(&file, path, FA_READ | (repair ? FA_WRITE : 0));
+    if(fres != FR_OK) {
+        printf("Failed to open %s (%d).\n", path, fres);
+        return -3;
     }
 
-    // Dump MLC.
-    if(mlc_base != 0) {
-        _dump_mlc(mlc_base);
+    nand_initialize(bank);
+
+    dump_nand_stage nand = {.stride = PAGE_SIZE + PAGE_SPARE_SIZE};
+    dump_file_stage fat = {.file = &file, .block_size = PAGE_SIZE + PAGE_SPARE_SIZE};
+
+    char label[16] = {0};
+    sprintf(label, "%s-RAW", name);
+
+    pipeline pipe = {
+        .name = label,
+        .source = {_dump_nand_start_read, _dump_nand_end_read, &nand},
+        .total = NAND_MAX_PAGE,
+        .block_size = PAGE_SIZE + PAGE_SPARE_SIZE,
+        .chunk = NAND_RING_DEPTH,
+        .depth = tuning_get()->depth,
+        .retries = DUMP_RETRIES,
+    };
+
+    pipeline_stage dest = {_dump_file_start_read, _dump_file_end, &fat};
+    pipeline_stage fix = {0};
+    if(repair) fix = (pipeline_stage){_dump_file_start_write, _dump_file_end, &fat};
+
+    int res = _dump_verify(&pipe, dest, fix);
+
+    fres = f_close(&file);
+    if(res < 0) {
+        printf("Failed to verify %s (%d).\n", path, res);
+        return -4;
+    }
+    if(fres != FR_OK) {
+        printf("Failed to close %s (%d).\n", path, fres);
+        return -5;
     }
 
-    return 0;
+    return res;
 }
 
 int _dump_partition_rednand(void)
@@ -455,6 +2202,7 @@ void dump_slc(void)
 
     u8 mbr[SDMMC_DEFAULT_BLOCKLEN] ALIGNED(32) = {0};
     u8* table = &mbr[0x1BE];
+    u8* part2 = &table[0x10];
     u8* part4 = &table[0x30];
 
     res = sdcard_read(0, 1, mbr);
@@ -465,7 +2213,14 @@ void dump_slc(void)
 
     u32 slc_base = LD_DWORD(&part4[0x8]);
 
-    res = _dump_slc(slc_base, NAND_BANK_SLC);
+    // this copy isn't journaled, so SLC's chunk hashes won't match any more
+    u32 data_base = part2[0x4] == 0xAE ? LD_DWORD(&part2[0x8]) : 0;
+    if(data_base && _dump_journal_load(data_base) == 0) {
+        journal->targets[JOURNAL_SLC].hashed = 0;
+        _dump_journal_save();
+    }
+
+    res = _dump_slc(slc_base, NAND_BANK_SLC, NULL);
     if(res) {
         printf("Failed to dump SLC (%d)!\n", res);
         goto slc_exit;
@@ -476,6 +2231,216 @@ slc_exit:
     smc_wait_events(SMC_POWER_BUTTON);
 }
 
+void dump_slc_sparse(void)
+{
+    int res = 0;
+
+    gfx_clear(GFX_ALL, BLACK);
+
+    printf("Dumping sparse SLC image to FAT32...\n");
+    res = _dump_slc_sparse(NAND_BANK_SLC);
+    if(res) {
+        printf("Failed to dump sparse SLC image (%d)!\n", res);
+        goto sparse_exit;
+    }
+
+    printf("Dumping sparse SLCCMPT image to FAT32...\n");
+    res = _dump_slc_sparse(NAND_BANK_SLCCMPT);
+    if(res) {
+        printf("Failed to dump sparse SLCCMPT image (%d)!\n", res);
+        goto sparse_exit;
+    }
+
+    printf("\nDone!\n");
+sparse_exit:
+    printf("Press POWER to exit.\n");
+    smc_wait_events(SMC_POWER_BUTTON);
+}
+
+void dump_expand_sparse(void)
+{
+    int res = 0;
+
+    gfx_clear(GFX_ALL, BLACK);
+
+    printf("Expanding SLC.SPR to SLC.RAW...\n");
+    res = _dump_expand_sparse(NAND_BANK_SLC);
+    if(res) {
+        printf("Failed to expand sparse SLC image (%d)!\n", res);
+        goto expand_exit;
+    }
+
+    printf("Expanding SLCCMPT.SPR to SLCCMPT.RAW...\n");
+    res = _dump_expand_sparse(NAND_BANK_SLCCMPT);
+    if(res) {
+        printf("Failed to expand sparse SLCCMPT image (%d)!\n", res);
+        goto expand_exit;
+    }
+
+    printf("\nDone!\n");
+expand_exit:
+    printf("Press POWER to exit.\n");
+    smc_wait_events(SMC_POWER_BUTTON);
+}
+
+void dump_restore_slc(void)
+{
+    int res = 0;
+
+    gfx_clear(GFX_ALL, BLACK);
+
+    printf("Restore SLC and SLCCMPT from SLC.RAW and SLCCMPT.RAW?\n");
+    printf("This overwrites sysNAND (except boot1/boot2).\n");
+    printf("[POWER] No | [EJECT] Yes...\n");
+    u8 input = smc_wait_events(SMC_POWER_BUTTON | SMC_EJECT_BUTTON);
+    if(input & SMC_POWER_BUTTON) return;
+
+    printf("Restoring SLC...\n");
+    res = _dump_restore_slc(NAND_BANK_SLC);
+    if(res) {
+        printf("Failed to restore SLC (%d)!\n", res);
+        goto restore_exit;
+    }
+
+    printf("Restoring SLCCMPT...\n");
+    res = _dump_restore_slc(NAND_BANK_SLCCMPT);
+    if(res) {
+        printf("Failed to restore SLCCMPT (%d)!\n", res);
+        goto restore_exit;
+    }
+
+    printf("\nDone!\n");
+restore_exit:
+    printf("Press POWER to exit.\n");
+    smc_wait_events(SMC_POWER_BUTTON);
+}
+
+void dump_restore_mlc(void)
+{
+    int res = 0;
+
+    gfx_clear(GFX_ALL, BLACK);
+
+    printf("Restore MLC from redNAND?\n");
+    printf("This overwrites all of sysNAND MLC.\n");
+    printf("[POWER] No | [EJECT] Yes...\n");
+    u8 input = smc_wait_events(SMC_POWER_BUTTON | SMC_EJECT_BUTTON);
+    if(input & SMC_POWER_BUTTON) return;
+
+    printf("Only write chunks that differ? MLC is read first, which is usually faster.\n");
+    printf("[POWER] Write all | [EJECT] Compare...\n");
+    input = smc_wait_events(SMC_POWER_BUTTON | SMC_EJECT_BUTTON);
+    bool compare = (input & SMC_EJECT_BUTTON) != 0;
+
+    u8 mbr[SDMMC_DEFAULT_BLOCKLEN] ALIGNED(32) = {0};
+    u8* table = &mbr[0x1BE];
+    u8* part2 = &table[0x10];
+    u8* part3 = &table[0x20];
+
+    res = sdcard_read(0, 1, mbr);
+    if(res) {
+        printf("Failed to read MBR (%d)!\n", res);
+        goto restore_exit;
+    }
+
+    if(part3[0x4] != 0xAE) {
+        printf("SD card has no redNAND partitions!\n");
+        goto restore_exit;
+    }
+
+    u32 data_base = part2[0x4] == 0xAE ? LD_DWORD(&part2[0x8]) : 0;
+    u32 mlc_base = LD_DWORD(&part3[0x8]);
+
+    printf("Restoring MLC...\n");
+    res = _dump_restore_mlc(mlc_base, data_base, compare);
+    if(res) {
+        printf("Failed to restore MLC (%d)!\n", res);
+        goto restore_exit;
+    }
+
+    printf("\nDone!\n");
+restore_exit:
+    printf("Press POWER to exit.\n");
+    smc_wait_events(SMC_POWER_BUTTON);
+}
+
+void dump_calibrate(void)
+{
+    gfx_clear(GFX_ALL, BLACK);
+
+    printf("Calibrate SD and MLC transfers?\n");
+    printf("This times copies of MLC into a scratch file, taking under a minute.\n");
+    printf("[POWER] No | [EJECT] Yes...\n");
+    u8 input = smc_wait_events(SMC_POWER_BUTTON | SMC_EJECT_BUTTON);
+    if(input & SMC_POWER_BUTTON) return;
+
+    int res = _dump_calibrate();
+    if(res) printf("Failed to calibrate (%d)!\n", res);
+    else printf("\nDone!\n");
+
+    printf("Press POWER to exit.\n");
+    smc_wait_events(SMC_POWER_BUTTON);
+}
+
+void dump_verify(void)
+{
+    int res = 0;
+
+    gfx_clear(GFX_ALL, BLACK);
+
+    printf("Rewrite anything that doesn't match?\n");
+    printf("[POWER] No, just report | [EJECT] Yes...\n");
+    u8 input = smc_wait_events(SMC_POWER_BUTTON | SMC_EJECT_BUTTON);
+    bool repair = (input & SMC_EJECT_BUTTON) != 0;
+
+    u8 mbr[SDMMC_DEFAULT_BLOCKLEN] ALIGNED(32) = {0};
+    u8* table = &mbr[0x1BE];
+    u8* part3 = &table[0x20];
+    u8* part4 = &table[0x30];
+
+    res = sdcard_read(0, 1, mbr);
+    if(res) {
+        printf("Failed to read MBR (%d)!\n", res);
+        goto verify_exit;
+    }
+
+    int mismatched = 0;
+    if(part3[0x4] == 0xAE && part4[0x4] == 0xAE)
+    {
+        u32 mlc_base = LD_DWORD(&part3[0x8]);
+        u32 slc_base = LD_DWORD(&part4[0x8]);
+        u32 slccmpt_base = slc_base + ((NAND_MAX_PAGE * PAGE_SIZE) / SDMMC_DEFAULT_BLOCKLEN);
+
+        printf("Verifying redNAND...\n");
+        res = _dump_verify_rednand(slc_base, slccmpt_base, mlc_base, repair);
+        if(res < 0) {
+            printf("Failed to verify redNAND (%d)!\n", res);
+            goto verify_exit;
+        }
+        mismatched += res;
+    }
+
+    FILINFO info = {0};
+    if(f_stat("SLC.RAW", &info) == FR_OK) {
+        printf("Verifying SLC-RAW...\n");
+        res = _dump_verify_slc_raw(NAND_BANK_SLC, repair);
+        if(res < 0) goto verify_exit;
+        mismatched += res;
+    }
+    if(f_stat("SLCCMPT.RAW", &info) == FR_OK) {
+        printf("Verifying SLCCMPT-RAW...\n");
+        res = _dump_verify_slc_raw(NAND_BANK_SLCCMPT, repair);
+        if(res < 0) goto verify_exit;
+        mismatched += res;
+    }
+
+    if(mismatched) printf("\n%d blocks didn't match%s.\n", mismatched, repair ? " and were rewritten" : "");
+    else printf("\nDone!\n");
+verify_exit:
+    printf("Press POWER to exit.\n");
+    smc_wait_events(SMC_POWER_BUTTON);
+}
+
 void dump_format_rednand(void)
 {
     int res = 0;
@@ -485,6 +2450,7 @@ void dump_format_rednand(void)
 
     u8 mbr[SDMMC_DEFAULT_BLOCKLEN] ALIGNED(32) = {0};
     u8* table = &mbr[0x1BE];
+    u8* part2 = &table[0x10];
     u8* part3 = &table[0x20];
     u8* part4 = &table[0x30];
 
@@ -498,20 +2464,48 @@ void dump_format_rednand(void)
         goto format_exit;
     }
 
-    printf("Dump SLC/SLCCMPT-RAW images? These are useful for sysNAND restore.\n");
-    printf("[POWER] Skip | [EJECT] Dump...\n");
-    u8 input = smc_wait_events(SMC_POWER_BUTTON | SMC_EJECT_BUTTON);
+    u32 data_base = part2[0x4] == 0xAE ? LD_DWORD(&part2[0x8]) : 0;
+
+    bool resume = false;
+    if(_dump_journal_resumable(data_base))
+    {
+        printf("A previous redNAND dump was interrupted. Resume it?\n");
+        printf("[POWER] Start over | [EJECT] Resume...\n");
+        u8 input = smc_wait_events(SMC_POWER_BUTTON | SMC_EJECT_BUTTON);
+        resume = (input & SMC_EJECT_BUTTON) != 0;
+    }
+
+    bool resync = false;
+    if(!resume && _dump_journal_synced(data_base))
+    {
+        printf("redNAND was fully copied before. Only rewrite what changed since?\n");
+        printf("Don't if redNAND has been booted since, its changes would be missed.\n");
+        printf("[POWER] Full copy | [EJECT] Resync...\n");
+        u8 input = smc_wait_events(SMC_POWER_BUTTON | SMC_EJECT_BUTTON);
+        resync = (input & SMC_EJECT_BUTTON) != 0;
+    }
+
+    u8 input = 0;
+    if(!resume) {
+        printf("Dump SLC/SLCCMPT-RAW images? These are useful for sysNAND restore.\n");
+        printf("[POWER] Skip | [EJECT] Dump...\n");
+        input = smc_wait_events(SMC_POWER_BUTTON | SMC_EJECT_BUTTON);
+    }
     if(input & SMC_EJECT_BUTTON)
     {
+        printf("Compress them? Writing is faster, but they need `lz4 -d` before use.\n");
+        printf("[POWER] Plain | [EJECT] Compress...\n");
+        bool compress = (smc_wait_events(SMC_POWER_BUTTON | SMC_EJECT_BUTTON) & SMC_EJECT_BUTTON) != 0;
+
         printf("Dumping SLC-RAW to FAT32...\n");
-        res = _dump_slc_raw(NAND_BANK_SLC);
+        res = _dump_slc_raw(NAND_BANK_SLC, compress);
         if(res) {
             printf("Failed to dump SLC-RAW (%d)!\n", res);
             goto format_exit;
         }
 
         printf("Dumping SLCCMPT-RAW to FAT32...\n");
-        res = _dump_slc_raw(NAND_BANK_SLCCMPT);
+        res = _dump_slc_raw(NAND_BANK_SLCCMPT, compress);
         if(res) {
             printf("Failed to dump SLCCMPT-RAW (%d)!\n", res);
             goto format_exit;
@@ -522,8 +2516,17 @@ void dump_format_rednand(void)
     u32 slc_base = LD_DWORD(&part4[0x8]);
     u32 slccmpt_base = slc_base + ((NAND_MAX_PAGE * PAGE_SIZE) / SDMMC_DEFAULT_BLOCKLEN);
 
+    bool sparse = false;
+    if(sdcard_erased_value() == 0x00)
+    {
+        printf("Erase zero-filled MLC regions instead of writing them? Usually faster.\n");
+        printf("[POWER] Write all | [EJECT] Erase...\n");
+        sparse = (smc_wait_events(SMC_POWER_BUTTON | SMC_EJECT_BUTTON) & SMC_EJECT_BUTTON) != 0;
+    }
+
     printf("Dumping redNAND...\n");
-    res = _dump_copy_rednand(slc_base, slccmpt_base, mlc_base);
+    dump_copy_mode mode = resume ? DUMP_COPY_RESUME : resync ? DUMP_COPY_RESYNC : DUMP_COPY_FULL;
+    res = _dump_copy_rednand(slc_base, slccmpt_base, mlc_base, data_base, mode, sparse);
     if(res) {
         printf("Failed to dump redNAND (%d)!\n", res);
         goto format_exit;
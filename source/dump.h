@@ -13,15 +13,47 @@
 
 #include "types.h"
 
-int _dump_mlc(u32 base);
-int _dump_slc(u32 base, u32 bank);
-int _dump_slc_raw(u32 bank);
+// Progress of one redNAND copy target, journaled to the redNAND DATA partition so
+// an interrupted copy can pick up where it left off. `done` and `total` are in
+// sectors for MLC and pages for SLC.
+typedef struct {
+    u32 base;
+    u32 total;
+    u32 done;
+    // the target's chunk hash list matches what's on the SD card
+    u32 hashed;
+} dump_journal_target;
+
+typedef enum {
+    DUMP_COPY_FULL,
+    DUMP_COPY_RESUME,
+    // only rewrite chunks that changed since the last complete copy
+    DUMP_COPY_RESYNC,
+} dump_copy_mode;
+
+int _dump_mlc(u32 base, dump_journal_target* target, bool sparse);
+int _dump_slc(u32 base, u32 bank, dump_journal_target* target);
+int _dump_slc_raw(u32 bank, bool compress);
+int _dump_slc_sparse(u32 bank);
+int _dump_expand_sparse(u32 bank);
+int _dump_restore_slc(u32 bank);
+int _dump_restore_mlc(u32 mlc_base, u32 data_base, bool compare);
+int _dump_calibrate(void);
+
+int _dump_verify_rednand(u32 slc_base, u32 slccmpt_base, u32 mlc_base, bool repair);
+int _dump_verify_slc_raw(u32 bank, bool repair);
 
 int _dump_partition_rednand(void);
-int _dump_copy_rednand(u32 slc_base, u32 slccmpt_base, u32 mlc_base);
+int _dump_copy_rednand(u32 slc_base, u32 slccmpt_base, u32 mlc_base, u32 data_base, dump_copy_mode mode, bool sparse);
 
 void dump_slc(void);
 void dump_format_rednand(void);
+void dump_slc_sparse(void);
+void dump_expand_sparse(void);
+void dump_restore_slc(void);
+void dump_restore_mlc(void);
+void dump_calibrate(void);
+void dump_verify(void);
 void dump_seeprom_otp();
 void dump_factory_log();
 
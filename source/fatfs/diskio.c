@@ -18,6 +18,41 @@
 #include "utils.h"
 
 static u8 buffer[SDMMC_DEFAULT_BLOCKLEN * SDHC_BLOCK_COUNT_MAX] ALIGNED(32);
+static struct sdhc_stream stream;
+
+/* How many of `count` sectors at `buff` can go out as one stream, if that's
+   more than a single command could do anyway. */
+static UINT stream_sectors (
+    const BYTE *buff,
+    UINT count
+)
+{
+    const UINT per = SDHC_STREAM_BOUNDARY / SDMMC_DEFAULT_BLOCKLEN;
+    UINT run = count / per * per;
+
+    if((u32)buff % SDHC_STREAM_BOUNDARY || run <= SDHC_BLOCK_COUNT_MAX)
+        return 0;
+    return run;
+}
+
+/* Transfers the whole run with a single open-ended command, see sdhc_stream_open(). */
+static int stream_run (
+    DWORD sector,
+    UINT count,
+    const BYTE *buff,
+    int write
+)
+{
+    if(sdcard_open_stream(sector, write, &stream) != 0)
+        return -1;
+
+    int res = sdhc_stream_push(&stream, (void*)buff, count * SDMMC_DEFAULT_BLOCKLEN);
+    if(res == 0)
+        res = sdhc_stream_wait(&stream, 1);
+
+    int close = sdhc_stream_close(&stream);
+    return res ? res : close;
+}
 
 /*-----------------------------------------------------------------------*/
 /* Get Disk Status                                                       */
@@ -71,6 +106,16 @@ DRESULT disk_read (
 {
     (void)pdrv;
 
+    UINT run = stream_sectors(buff, count);
+    if(run) {
+        if(stream_run(sector, run, buff, 0) != 0)
+            return RES_ERROR;
+
+        sector += run;
+        count -= run;
+        buff += run * SDMMC_DEFAULT_BLOCKLEN;
+    }
+
     while(count) {
         u32 work = min(count, SDHC_BLOCK_COUNT_MAX);
 
@@ -103,12 +148,27 @@ DRESULT disk_write (
 {
     (void)pdrv;
 
+    UINT run = stream_sectors(buff, count);
+    if(run) {
+        if(stream_run(sector, run, buff, 1) != 0)
+            return RES_ERROR;
+
+        sector += run;
+        count -= run;
+        buff += run * SDMMC_DEFAULT_BLOCKLEN;
+    }
+
     while(count) {
         u32 work = min(count, SDHC_BLOCK_COUNT_MAX);
 
-        memcpy(buffer, buff, work * SDMMC_DEFAULT_BLOCKLEN);
+        // big aligned writes (e.g. from a dump's buffers) can be DMA'd as they are
+        const BYTE* data = buff;
+        if((u32)buff & 31) {
+            memcpy(buffer, buff, work * SDMMC_DEFAULT_BLOCKLEN);
+            data = buffer;
+        }
 
-        if(sdcard_write(sector, work, buffer) != 0)
+        if(sdcard_write(sector, work, (void*)data) != 0)
             return RES_ERROR;
 
         sector += work;
@@ -9,6 +9,7 @@
  */
 
 #include "gfx.h"
+#include "utils.h"
 #include <stdio.h>
 
 extern const u8 msx_font[];
@@ -139,6 +140,22 @@ void gfx_draw_string(gfx_screen_t screen, char* str, int x, int y, u32 color)
 	}
 }
 
+// The console never writes to the bottom margin, so status lines there can be
+// redrawn in place without scrolling anything. Line 0 is the bottom one. Padded
+// with spaces to the full width to erase the previous one.
+void gfx_draw_status(int line_no, const char* str)
+{
+	if(line_no < 0 || line_no >= GFX_STATUS_LINES) return;
+
+	for(int i = 0; i < GFX_ALL; i++) {
+		char line[256];
+		int chars = min((fbs[i].width - 20) / CHAR_SIZE_X, (int)sizeof(line) - 1);
+
+		snprintf(line, chars + 1, "%-*s", chars, str);
+		gfx_draw_string(i, line, 10, fbs[i].height - 15 - 10 * line_no, WHITE);
+	}
+}
+
 // This sucks, should use a stdout devoptab.
 int printf(const char* fmt, ...)
 {
@@ -161,7 +178,7 @@ int printf(const char* fmt, ...)
 	}
 
 	for(int i = 0; i < GFX_ALL; i++) {
-		if(fbs[i].current_y + lines >= fbs[i].height - 20)
+		if(fbs[i].current_y + lines >= fbs[i].height - 10 - 10 * GFX_STATUS_LINES)
 			gfx_clear(i, BLACK);
 
 		gfx_draw_string(i, str, /* current_x */ 10, fbs[i].current_y, WHITE);
@@ -28,6 +28,10 @@ typedef enum {
 void gfx_draw_plot(gfx_screen_t screen, int x, int y, u32 color);
 void gfx_clear(gfx_screen_t screen, u32 color);
 void gfx_draw_string(gfx_screen_t screen, char* str, int x, int y, u32 color);
+// lines kept free at the bottom of the screen for gfx_draw_status()
+#define GFX_STATUS_LINES 2
+
+void gfx_draw_status(int line_no, const char* str);
 int printf(const char* fmt, ...);
 
 #endif
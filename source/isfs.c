@@ -21,6 +21,7 @@
 
 #include "ff.h"
 #include "nand.h"
+#include "nand_map.h"
 #include "sdmmc.h"
 #include "sdcard.h"
 
@@ -74,8 +75,6 @@ static isfs_ctx* _isfs_get_volume(int volume)
     return NULL;
 }
 
-static u8 ecc_buf[ECC_BUFFER_ALLOC] ALIGNED(128);
-
 static int _isfs_read_pages(isfs_ctx* ctx, void* buffer, u32 start, u32 pages)
 {
     if(ctx->bank & 0x80000000) {
@@ -96,15 +95,7 @@ static int _isfs_read_pages(isfs_ctx* ctx, void* buffer, u32 start, u32 pages)
         if(sdcard_read(base + make_sector(start), make_sector(pages), buffer))
             return -1;
     } else {
-        nand_initialize(ctx->bank);
-
-        u32 i, j;
-        for(i = start, j = 0; i < start + pages; i++, j += PAGE_SIZE)
-        {
-            nand_read_page(i, buffer + j, ecc_buf);
-            nand_wait();
-            nand_correct(i, buffer + j, ecc_buf);
-        }
+        nand_read_bank_pages(ctx->bank, start, pages, buffer);
     }
 
     return 0;
@@ -322,6 +313,10 @@ static int _isfs_load_super(isfs_ctx* ctx)
 
     for(u32 i = start; i < end; i += size)
     {
+        // no point reading superblock candidates from blocks known to be bad
+        if(!(ctx->bank & 0x80000000) && nand_map_get(ctx->bank, i / BLOCK_SIZE) == NAND_BLOCK_BAD)
+            continue;
+
         res = _isfs_read_pages(ctx, super, i, 1);
         if(res) {
             ctx->mounted = false;
@@ -586,6 +581,11 @@ int isfs_fini(void)
 {
     if(!initialized) return 0;
 
+    nand_cache_stats stats;
+    nand_get_cache_stats(&stats);
+    printf("ISFS: %lu NAND bank switches, %lu of %lu pages from cache\n",
+            nand_get_bank_switches(), stats.hits, stats.hits + stats.misses);
+
     for(int i = 0; i < _isfs_num_volumes(); i++)
     {
         isfs_ctx* ctx = &isfs[i];
@@ -0,0 +1,162 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *  Copyright (C) 2016          Daz Jones <daz@dazzozo.com>
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#include "lz4.h"
+#include "utils.h"
+
+#include <string.h>
+
+#define LZ4_MAGIC           0x184D2204
+// version 1, independent blocks, no checksums
+#define LZ4_FLG             0x60
+// 256 KiB max block size
+#define LZ4_BD              0x50
+// (XXH32(FLG, BD) >> 8) & 0xFF, fixed since the descriptor is
+#define LZ4_HC              0xFB
+#define LZ4_UNCOMPRESSED    0x80000000
+
+#define LZ4_HASH_BITS       12
+#define LZ4_MIN_MATCH       4
+#define LZ4_MAX_OFFSET      0xFFFF
+// the format requires the last 5 bytes to be literals, and the last match to
+// start at least 12 bytes before the end of the block
+#define LZ4_LAST_LITERALS   5
+#define LZ4_MF_LIMIT        12
+
+static u32 lz4_table[1 << LZ4_HASH_BITS];
+
+static inline u32 _lz4_read32(const u8* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((u32)p[3] << 24);
+}
+
+static inline u32 _lz4_hash(const u8* p)
+{
+    return (_lz4_read32(p) * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+static inline u8* _lz4_write32(u8* p, u32 value)
+{
+    // little-endian, whatever we're running on
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+    return p + 4;
+}
+
+static u8* _lz4_write_length(u8* op, u32 length)
+{
+    for(; length >= 0xFF; length -= 0xFF)
+        *op++ = 0xFF;
+    *op++ = length;
+    return op;
+}
+
+static u8* _lz4_write_sequence(u8* op, const u8* literals, u32 count, u32 offset, u32 match)
+{
+    u8* token = op++;
+    *token = min(count, 15u) << 4;
+    if(count >= 15) op = _lz4_write_length(op, count - 15);
+
+    memcpy(op, literals, count);
+    op += count;
+
+    // the final sequence is literals only
+    if(!offset) return op;
+
+    *op++ = offset;
+    *op++ = offset >> 8;
+
+    match -= LZ4_MIN_MATCH;
+    *token |= min(match, 15u);
+    if(match >= 15) op = _lz4_write_length(op, match - 15);
+
+    return op;
+}
+
+// Greedy single-pass compressor, one hash probe per position. Not the best ratio,
+// but erased pages and padding are long runs that any match finder gets.
+u32 lz4_compress(const void* src, u32 size, void* dst)
+{
+    const u8* base = (const u8*)src;
+    const u8* ip = base;
+    const u8* anchor = base;
+    const u8* end = base + size;
+    u8* op = (u8*)dst;
+
+    if(size > LZ4_MF_LIMIT) {
+        const u8* mf_limit = end - LZ4_MF_LIMIT;
+        const u8* match_limit = end - LZ4_LAST_LITERALS;
+
+        memset(lz4_table, 0, sizeof(lz4_table));
+        lz4_table[_lz4_hash(ip)] = 0;
+        ip++;
+
+        while(ip < mf_limit) {
+            u32 h = _lz4_hash(ip);
+            const u8* match = base + lz4_table[h];
+            lz4_table[h] = ip - base;
+
+            if(match >= ip || ip - match > LZ4_MAX_OFFSET || _lz4_read32(match) != _lz4_read32(ip)) {
+                ip++;
+                continue;
+            }
+
+            while(ip > anchor && match > base && ip[-1] == match[-1]) {
+                ip--; match--;
+            }
+
+            const u8* mp = ip + LZ4_MIN_MATCH;
+            const u8* mm = match + LZ4_MIN_MATCH;
+            while(mp < match_limit && *mp == *mm) {
+                mp++; mm++;
+            }
+
+            op = _lz4_write_sequence(op, anchor, ip - anchor, ip - match, mp - ip);
+            ip = anchor = mp;
+
+            if(ip < mf_limit) lz4_table[_lz4_hash(ip - 2)] = ip - 2 - base;
+        }
+    }
+
+    op = _lz4_write_sequence(op, anchor, end - anchor, 0, 0);
+    return op - (u8*)dst;
+}
+
+u32 lz4_frame_begin(void* dst)
+{
+    u8* p = _lz4_write32((u8*)dst, LZ4_MAGIC);
+    p[0] = LZ4_FLG;
+    p[1] = LZ4_BD;
+    p[2] = LZ4_HC;
+    return LZ4_HEADER_SIZE;
+}
+
+u32 lz4_frame_block(const void* src, u32 size, void* dst)
+{
+    u8* p = (u8*)dst;
+
+    u32 packed = lz4_compress(src, size, p + 4);
+    if(packed >= size) {
+        memcpy(p + 4, src, size);
+        _lz4_write32(p, size | LZ4_UNCOMPRESSED);
+        return 4 + size;
+    }
+
+    _lz4_write32(p, packed);
+    return 4 + packed;
+}
+
+u32 lz4_frame_end(void* dst)
+{
+    _lz4_write32((u8*)dst, 0);
+    return LZ4_END_SIZE;
+}
@@ -0,0 +1,33 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *  Copyright (C) 2016          Daz Jones <daz@dazzozo.com>
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#ifndef _LZ4_H
+#define _LZ4_H
+
+#include "types.h"
+
+// Minimal LZ4 frame writer (the format of the `lz4` command line tool). Blocks are
+// compressed independently, so a frame can be decoded in parallel, and a block
+// that doesn't shrink is stored as-is.
+#define LZ4_BLOCK_MAX       (0x40000) // 256 KiB
+#define LZ4_HEADER_SIZE     (7)
+#define LZ4_END_SIZE        (4)
+
+// worst case output of lz4_frame_block() for `size` bytes of input
+#define LZ4_BLOCK_BOUND(size) (4 + (size) + (size) / 255 + 16)
+
+u32 lz4_compress(const void* src, u32 size, void* dst);
+
+u32 lz4_frame_begin(void* dst);
+// `size` must not exceed LZ4_BLOCK_MAX.
+u32 lz4_frame_block(const void* src, u32 size, void* dst);
+u32 lz4_frame_end(void* dst);
+
+#endif
@@ -36,6 +36,7 @@
 #include "filepicker.h"
 #include "ancast.h"
 #include "minini.h"
+#include "tuning.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <malloc.h>
@@ -93,6 +94,7 @@ u32 _main(void *base)
         panic(0);
     }
     mlc_ack_card();
+    tuning_load();
 
     printf("Mounting SLC...\n");
     isfs_init();
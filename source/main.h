@@ -38,6 +38,12 @@ menu menu_main = {
             {"Boot IOP firmware file", &main_boot_fw},
             {"Boot PowerPC ELF file", &main_boot_ppc},
             {"Format redNAND", &dump_format_rednand},
+            {"Dump sparse SLC images", &dump_slc_sparse},
+            {"Expand sparse SLC images", &dump_expand_sparse},
+            {"Restore SLC from raw images", &dump_restore_slc},
+            {"Restore MLC from redNAND", &dump_restore_mlc},
+            {"Verify redNAND and raw images", &dump_verify},
+            {"Calibrate SD/MLC transfers", &dump_calibrate},
             {"Dump SEEPROM & OTP", &dump_seeprom_otp},
             {"Dump factory log", &dump_factory_log},
             {"Display crash log", &main_get_crash},
@@ -48,7 +54,7 @@ menu menu_main = {
             {"Credits", &main_credits},
             //{"ISFS test", &isfs_test},
     },
-    12, // number of options
+    18, // number of options
     0,
     0
 };
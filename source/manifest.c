@@ -0,0 +1,146 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *  Copyright (C) 2016          Daz Jones <daz@dazzozo.com>
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#include "manifest.h"
+#include "utils.h"
+#include "gfx.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <malloc.h>
+
+int manifest_init(manifest* m, const char* name, u64 start, u64 size)
+{
+    memset(m, 0, sizeof(*m));
+
+    m->name = name;
+    m->start = start;
+    m->size = size;
+    m->segment = MANIFEST_SEGMENT;
+    m->offset = start;
+
+    u32 segments = (size + m->segment - 1) / m->segment;
+    m->digests = malloc(segments * SHA_HASH_SIZE);
+    if(!m->digests) return -1;
+    memset(m->digests, 0, segments * SHA_HASH_SIZE);
+
+    sha_init(&m->whole);
+    sha_init(&m->part);
+
+    return 0;
+}
+
+// Finishes the segment `m->offset` just got to the end of, if it did.
+static void _manifest_end_segment(manifest* m)
+{
+    if((m->offset % m->segment) == 0 || m->offset == m->size) {
+        u32 index = (m->offset - 1) / m->segment;
+        // a resumed dump may start part way into a segment, which is left out
+        if(index * (u64)m->segment >= m->start) {
+            sha_final(&m->part, m->digests[index]);
+            m->count++;
+        }
+        sha_init(&m->part);
+    }
+}
+
+void manifest_update(manifest* m, const void* data, u32 size)
+{
+    const u8* buf = (const u8*)data;
+
+    if(m->start == 0)
+        sha_update(&m->whole, buf, size);
+
+    while(size)
+    {
+        u32 used = m->offset % m->segment;
+        u32 work = min(size, m->segment - used);
+
+        sha_update(&m->part, buf, work);
+        m->offset += work;
+        buf += work;
+        size -= work;
+
+        _manifest_end_segment(m);
+    }
+}
+
+void manifest_update_digest(manifest* m, const u8* digest, u32 size)
+{
+    if(m->start == 0)
+        sha_update(&m->whole, digest, SHA_HASH_SIZE);
+
+    // chunks never cross a segment
+    sha_update(&m->part, digest, SHA_HASH_SIZE);
+    m->offset += size;
+
+    _manifest_end_segment(m);
+}
+
+static void _manifest_print_digest(FILE* file, const u8* digest)
+{
+    for(int i = 0; i < SHA_HASH_SIZE; i++)
+        fprintf(file, "%02x", digest[i]);
+}
+
+int manifest_finish(manifest* m)
+{
+    char path[64] = {0};
+    sprintf(path, "sdmc:/%s.sha1", m->name);
+
+    FILE* file = fopen(path, "w");
+    if(!file) {
+        printf("Failed to open %s.\n", path);
+        manifest_free(m);
+        return -1;
+    }
+
+    fprintf(file, "name %s\n", m->name);
+    fprintf(file, "size 0x%lX%08lX\n", (u32)(m->size >> 32), (u32)m->size);
+    fprintf(file, "segment 0x%lX\n", m->segment);
+    if(m->chunk)
+        fprintf(file, "chunk 0x%lX\n", m->chunk);
+
+    if(m->start == 0 && m->offset == m->size) {
+        u8 digest[SHA_HASH_SIZE];
+        sha_final(&m->whole, digest);
+
+        fprintf(file, "image ");
+        _manifest_print_digest(file, digest);
+        fprintf(file, "\n");
+    }
+
+    u32 segments = (m->size + m->segment - 1) / m->segment;
+    for(u32 i = 0; i < segments; i++) {
+        u64 begin = i * (u64)m->segment;
+        u64 end = min(begin + m->segment, m->size);
+        if(begin < m->start || end > m->offset) continue;
+
+        fprintf(file, "0x%08lX ", i);
+        _manifest_print_digest(file, m->digests[i]);
+        fprintf(file, "\n");
+    }
+
+    int res = fclose(file);
+    manifest_free(m);
+
+    if(res) {
+        printf("Failed to write %s.\n", path);
+        return -2;
+    }
+
+    return 0;
+}
+
+void manifest_free(manifest* m)
+{
+    free(m->digests);
+    m->digests = NULL;
+}
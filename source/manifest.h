@@ -0,0 +1,51 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *  Copyright (C) 2016          Daz Jones <daz@dazzozo.com>
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#ifndef _MANIFEST_H
+#define _MANIFEST_H
+
+#include "types.h"
+#include "sha.h"
+
+// SHA-1 manifest for a dump: a digest per `segment` bytes, plus one for the whole
+// image if it was hashed from the start. Data has to be fed in order.
+#define MANIFEST_SEGMENT    (0x1000000) // 16 MiB
+
+typedef struct {
+    const char* name;
+    u64 start;
+    u64 size;
+    u32 segment;
+    // 0 when the digests are of the data itself; otherwise whoever copies it
+    // already hashes it in chunks of this many bytes (which divide the segment),
+    // and the digests are of those chunk digests, see manifest_update_digest()
+    u32 chunk;
+
+    u64 offset;
+    sha_ctx whole;
+    sha_ctx part;
+
+    u8 (*digests)[SHA_HASH_SIZE];
+    u32 count;
+} manifest;
+
+// `start` is where hashing begins, e.g. for a resumed dump (which then gets no
+// whole-image digest).
+int manifest_init(manifest* m, const char* name, u64 start, u64 size);
+void manifest_update(manifest* m, const void* data, u32 size);
+// Feeds the SHA-1 of the next `size` bytes instead of the bytes themselves, so
+// data that's already hashed isn't hashed again. `size` is m->chunk, less only
+// for the last chunk.
+void manifest_update_digest(manifest* m, const u8* digest, u32 size);
+// Writes sdmc:/<name>.sha1 and frees the manifest.
+int manifest_finish(manifest* m);
+void manifest_free(manifest* m);
+
+#endif
@@ -25,7 +25,6 @@
 #endif
 
 //#define MLC_DEBUG
-//#define MLC_SUPPORT_WRITE
 
 #ifdef MLC_DEBUG
 static int mlcdebug = 3;
@@ -45,6 +44,8 @@ struct mlc_ctx {
 
     u32 num_sectors;
     u16 rca;
+
+    u32 cid[4];
 };
 
 static struct mlc_ctx card;
@@ -76,6 +77,64 @@ void mlc_abort(void) {
     sdhc_exec_command(card.handle, &cmd);
 }
 
+static u8 ext_csd[MMC_EXT_CSD_SIZE] ALIGNED(32);
+
+static int mlc_read_ext_csd(void)
+{
+    struct sdmmc_command cmd;
+
+    DPRINTF(2, ("mlc: MMC_SEND_EXT_CSD\n"));
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.c_opcode = MMC_SEND_EXT_CSD;
+    cmd.c_arg = 0;
+    cmd.c_data = ext_csd;
+    cmd.c_datalen = sizeof(ext_csd);
+    cmd.c_blklen = sizeof(ext_csd);
+    cmd.c_flags = SCF_RSP_R1 | SCF_CMD_ADTC | SCF_CMD_READ;
+    sdhc_exec_command(card.handle, &cmd);
+    if (cmd.c_error) {
+        printf("mlc: MMC_SEND_EXT_CSD failed with %d\n", cmd.c_error);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Writes one EXT_CSD byte. The device only says whether it took the value
+// in the status after the busy period.
+static int mlc_switch(u8 index, u8 value)
+{
+    struct sdmmc_command cmd;
+
+    DPRINTF(2, ("mlc: MMC_SWITCH(%u, %u)\n", index, value));
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.c_opcode = MMC_SWITCH;
+    cmd.c_arg = MMC_SWITCH_ARG(index, value);
+    cmd.c_flags = SCF_RSP_R1B;
+    sdhc_exec_command(card.handle, &cmd);
+    if (cmd.c_error) {
+        printf("mlc: MMC_SWITCH(%u, %u) failed with %d\n", index, value, cmd.c_error);
+        return -1;
+    }
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.c_opcode = MMC_SEND_STATUS;
+    cmd.c_arg = ((u32)card.rca)<<16;
+    cmd.c_flags = SCF_RSP_R1;
+    sdhc_exec_command(card.handle, &cmd);
+    if (cmd.c_error) {
+        printf("mlc: MMC_SEND_STATUS failed with %d\n", cmd.c_error);
+        return -1;
+    }
+
+    if (ISSET(MMC_R1(cmd.c_resp), MMC_R1_SWITCH_ERROR)) {
+        printf("mlc: MMC_SWITCH(%u, %u) refused\n", index, value);
+        return -1;
+    }
+
+    return 0;
+}
+
 void mlc_needs_discover(void)
 {
     struct sdmmc_command cmd;
@@ -161,6 +220,7 @@ void mlc_needs_discover(void)
 
     //resp = (u8 *)cmd.c_resp;
     resp32 = (u32 *)cmd.c_resp;
+    memcpy(card.cid, resp32, sizeof(card.cid));
 
     /*printf("CID: mid=%02x name='%c%c%c%c%c%c%c' prv=%d.%d psn=%02x%02x%02x%02x mdt=%d/%d\n", resp[14],
         resp[13],resp[12],resp[11],resp[10],resp[9],resp[8],resp[7], resp[6], resp[5] >> 4, resp[5] & 0xf,
@@ -237,62 +297,74 @@ void mlc_needs_discover(void)
         goto out_clock;
     }
 
-    DPRINTF(2, ("mlc: MMC_SWITCH(0x3B70101)\n"));
-    memset(&cmd, 0, sizeof(cmd));
-    cmd.c_opcode = MMC_SWITCH;
-    cmd.c_arg = 0x3B70101;
-    cmd.c_flags = SCF_RSP_R1B;
-    sdhc_exec_command(card.handle, &cmd);
-    if (cmd.c_error) {
-        printf("mlc: MMC_SWITCH(0x3B70101) failed with %d\n", cmd.c_error);
+    // still 1-bit here, so this read works whatever the board wired up
+    if (mlc_read_ext_csd() != 0) {
         card.inserted = card.selected = 0;
         goto out_clock;
     }
 
-    sdhc_bus_width(card.handle, 4);
-
-    u8 ext_csd[512] ALIGNED(32) = {0};
+    u8 card_type = ext_csd[EXT_CSD_CARD_TYPE];
+    card.num_sectors = EXT_CSD_SEC_COUNT_VALUE(ext_csd);
+    printf("mlc: card_type=0x%x sec_count=0x%lx\n", card_type, card.num_sectors);
 
-    DPRINTF(2, ("mlc: MMC_SEND_EXT_CSD\n"));
-    memset(&cmd, 0, sizeof(cmd));
-    cmd.c_opcode = MMC_SEND_EXT_CSD;
-    cmd.c_arg = 0;
-    cmd.c_data = ext_csd;
-    cmd.c_datalen = sizeof(ext_csd);
-    cmd.c_blklen = sizeof(ext_csd);
-    cmd.c_flags = SCF_RSP_R1 | SCF_CMD_ADTC | SCF_CMD_READ;
-    sdhc_exec_command(card.handle, &cmd);
-    if (cmd.c_error) {
-        printf("mlc: MMC_SEND_EXT_CSD failed with %d\n", cmd.c_error);
+    // sector addressed devices have to report their size here
+    if (card.num_sectors == 0) {
+        printf("mlc: EXT_CSD has no sector count\n");
         card.inserted = card.selected = 0;
         goto out_clock;
     }
 
-    u8 card_type = ext_csd[0xC4];
-    u32 clk = 26000;
-    if(card_type & 0xE) clk = 52000;
-
-    card.num_sectors = (u32)ext_csd[0xD4] | ext_csd[0xD5] << 8 | ext_csd[0xD6] << 16 | ext_csd[0xD7] << 24;
-    printf("mlc: card_type=0x%x sec_count=0x%lx\n", card_type, card.num_sectors);
-
-    DPRINTF(2, ("mlc: MMC_SWITCH(0x3B90101)\n"));
-    memset(&cmd, 0, sizeof(cmd));
-    cmd.c_opcode = MMC_SWITCH;
-    cmd.c_arg = 0x3B90101;
-    cmd.c_flags = SCF_RSP_R1B;
-    sdhc_exec_command(card.handle, &cmd);
-    if (cmd.c_error) {
-        printf("mlc: MMC_SWITCH(0x3B90101) failed with %d\n", cmd.c_error);
-        card.inserted = card.selected = 0;
-        goto out_clock;
+    u32 clk = 20000;
+    int timing = SDMMC_TIMING_LEGACY;
+    if (sdhc_bus_high_speed(card.handle) && (card_type & (EXT_CSD_CARD_TYPE_26M | EXT_CSD_CARD_TYPE_52M))) {
+        if (mlc_switch(EXT_CSD_HS_TIMING, 1) == 0) {
+            clk = (card_type & EXT_CSD_CARD_TYPE_52M) ? 52000 : 26000;
+            timing = SDMMC_TIMING_HIGHSPEED;
+        }
     }
 
     DPRINTF(1, ("mlc: enabling clock\n"));
-    if (sdhc_bus_clock(card.handle, clk, SDMMC_TIMING_HIGHSPEED) != 0) {
+    if (sdhc_bus_clock(card.handle, clk, timing) != 0) {
         printf("mlc: could not enable clock for card\n");
         goto out_power;
     }
 
+    // The host may have more data lines than the board connects, so read the
+    // EXT_CSD back at each width and settle on the first one that works.
+    static const struct {
+        int width;
+        u8 value;
+    } widths[] = {
+        { 8, EXT_CSD_BUS_WIDTH_8 },
+        { 4, EXT_CSD_BUS_WIDTH_4 },
+        { 1, EXT_CSD_BUS_WIDTH_1 },
+    };
+
+    int width = 0;
+    for (int i = 0; i < sizeof(widths) / sizeof(widths[0]); i++) {
+        if (widths[i].width > sdhc_bus_width_max(card.handle))
+            continue;
+
+        if (mlc_switch(EXT_CSD_BUS_WIDTH, widths[i].value) != 0)
+            continue;
+        sdhc_bus_width(card.handle, widths[i].width);
+
+        if (mlc_read_ext_csd() == 0 && EXT_CSD_SEC_COUNT_VALUE(ext_csd) == card.num_sectors) {
+            width = widths[i].width;
+            break;
+        }
+
+        printf("mlc: %d-bit bus failed, trying narrower\n", widths[i].width);
+    }
+
+    if (!width) {
+        card.inserted = card.selected = 0;
+        goto out_clock;
+    }
+
+    printf("mlc: %d-bit bus, %s (%lu MHz)\n", width,
+           timing == SDMMC_TIMING_HIGHSPEED ? "high speed" : "legacy", clk / 1000);
+
     return;
 
 out_clock:
@@ -387,7 +459,7 @@ int mlc_start_read(u32 blk_start, u32 blk_count, void *data, struct sdmmc_comman
     cmdbuf->c_datalen = blk_count * SDMMC_DEFAULT_BLOCKLEN;
     cmdbuf->c_blklen = SDMMC_DEFAULT_BLOCKLEN;
     cmdbuf->c_flags = SCF_RSP_R1 | SCF_CMD_READ;
-    sdhc_async_command(card.handle, cmdbuf);
+    sdhc_queue_command(card.handle, cmdbuf);
 
     if (cmdbuf->c_error) {
         printf("mlc: MMC_READ_BLOCK_%s failed with %d\n", blk_count > 1 ? "MULTIPLE" : "SINGLE", cmdbuf->c_error);
@@ -421,7 +493,7 @@ int mlc_end_read(struct sdmmc_command* cmdbuf)
         return -1;
     }
 
-    sdhc_async_response(card.handle, cmdbuf);
+    sdhc_wait_command(card.handle, cmdbuf);
 
     if (cmdbuf->c_error) {
         printf("mlc: MMC_READ_BLOCK_%s failed with %d\n", cmdbuf->c_opcode == MMC_READ_BLOCK_MULTIPLE ? "MULTIPLE" : "SINGLE", cmdbuf->c_error);
@@ -488,6 +560,45 @@ int mlc_read(u32 blk_start, u32 blk_count, void *data)
     return 0;
 }
 
+int mlc_open_stream(u32 blk_start, int write, struct sdhc_stream* stream)
+{
+#ifndef MLC_SUPPORT_WRITE
+    if (write)
+        return -1;
+#endif
+    if (card.inserted == 0) {
+        printf("mlc: STREAM: no card inserted.\n");
+        return -1;
+    }
+
+    if (card.selected == 0) {
+        if (mlc_select() < 0) {
+            printf("mlc: STREAM: cannot select card.\n");
+            return -1;
+        }
+    }
+
+    if (card.new_card == 1) {
+        printf("mlc: new card inserted but not acknowledged yet.\n");
+        return -1;
+    }
+
+    memset(&stream->cmd, 0, sizeof(struct sdmmc_command));
+
+    stream->cmd.c_opcode = write ? MMC_WRITE_BLOCK_MULTIPLE : MMC_READ_BLOCK_MULTIPLE;
+    if (card.sdhc_blockmode)
+        stream->cmd.c_arg = blk_start;
+    else
+        stream->cmd.c_arg = blk_start * SDMMC_DEFAULT_BLOCKLEN;
+    stream->cmd.c_blklen = SDMMC_DEFAULT_BLOCKLEN;
+    stream->cmd.c_flags = write ? SCF_RSP_R1 : SCF_RSP_R1 | SCF_CMD_READ;
+    sdhc_stream_open(card.handle, stream);
+
+    DPRINTF(2, ("mlc: stream %s opened at %u\n", write ? "WRITE" : "READ", blk_start));
+
+    return 0;
+}
+
 int mlc_start_write(u32 blk_start, u32 blk_count, void *data, struct sdmmc_command* cmdbuf)
 {
 #ifndef MLC_SUPPORT_WRITE
@@ -527,7 +638,7 @@ int mlc_start_write(u32 blk_start, u32 blk_count, void *data, struct sdmmc_comma
     cmdbuf->c_datalen = blk_count * SDMMC_DEFAULT_BLOCKLEN;
     cmdbuf->c_blklen = SDMMC_DEFAULT_BLOCKLEN;
     cmdbuf->c_flags = SCF_RSP_R1;
-    sdhc_async_command(card.handle, cmdbuf);
+    sdhc_queue_command(card.handle, cmdbuf);
 
     if (cmdbuf->c_error) {
         printf("mlc: MMC_WRITE_BLOCK_%s failed with %d\n", blk_count > 1 ? "MULTIPLE" : "SINGLE", cmdbuf->c_error);
@@ -564,7 +675,7 @@ int mlc_end_write(struct sdmmc_command* cmdbuf)
         return -1;
     }
 
-    sdhc_async_response(card.handle, cmdbuf);
+    sdhc_wait_command(card.handle, cmdbuf);
 
     if (cmdbuf->c_error) {
         printf("mlc: MMC_WRITE_BLOCK_%s failed with %d\n", cmdbuf->c_opcode == MMC_WRITE_BLOCK_MULTIPLE ? "MULTIPLE" : "SINGLE", cmdbuf->c_error);
@@ -674,6 +785,15 @@ int mlc_get_sectors(void)
     return card.num_sectors;
 }
 
+int mlc_get_cid(u32 *cid)
+{
+    if (card.inserted == 0 || card.new_card == 1)
+        return -1;
+
+    memcpy(cid, card.cid, sizeof(card.cid));
+    return 0;
+}
+
 void mlc_irq(void)
 {
     sdhc_intr(&mlc_host);
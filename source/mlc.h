@@ -16,6 +16,11 @@
 #include "bsdtypes.h"
 #include "sdmmc.h"
 
+struct sdhc_stream;
+
+// Needed for restoring MLC from redNAND.
+#define MLC_SUPPORT_WRITE 1
+
 void mlc_init(void);
 void mlc_exit(void);
 void mlc_irq(void);
@@ -28,6 +33,7 @@ int mlc_select(void);
 int mlc_check_card(void);
 int mlc_ack_card(void);
 int mlc_get_sectors(void);
+int mlc_get_cid(u32 *cid);
 
 int mlc_read(u32 blk_start, u32 blk_count, void *data);
 int mlc_write(u32 blk_start, u32 blk_count, void *data);
@@ -38,4 +44,7 @@ int mlc_end_read(struct sdmmc_command* cmdbuf);
 int mlc_start_write(u32 blk_start, u32 blk_count, void *data, struct sdmmc_command* cmdbuf);
 int mlc_end_write(struct sdmmc_command* cmdbuf);
 
+// Opens an open-ended read or write on the card's host, see sdhc_stream_open().
+int mlc_open_stream(u32 blk_start, int write, struct sdhc_stream* stream);
+
 #endif
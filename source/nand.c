@@ -23,8 +23,6 @@
 #include "types.h"
 
 //#define NAND_DEBUG  1
-//#define NAND_SUPPORT_WRITE 1
-//#define NAND_SUPPORT_ERASE 1
 
 #ifdef NAND_DEBUG
 #   define  NAND_debug(f, arg...) printf("NAND: " f, ##arg);
@@ -52,11 +50,30 @@
 #define NAND_FLAGS_ECC  0x1000
 
 static u32 initialized = 0;
+static u32 bank_switches = 0;
 static volatile int irq_flag;
 static u32 last_page_read = 0;
+
+// Spare buffers for pipelined reads. The controller wants them 128-byte aligned,
+// so each slot is padded out to 0x80 bytes rather than ECC_BUFFER_ALLOC.
+static u8 ring_ecc[NAND_RING_DEPTH][0x80] ALIGNED(128);
+// set for slots that were filled in for a known-erased block instead of being read
+static bool ring_fill[NAND_RING_DEPTH];
+// last page of a block whose first page came back erased, read before trusting it
+static u8 probe_data[PAGE_SIZE] ALIGNED(64);
+static u8 probe_ecc[0x80] ALIGNED(128);
+static nand_ring* volatile active_ring = NULL;
+
+static void __nand_ring_complete(nand_ring* ring);
 #if defined(NAND_SUPPORT_ERASE) || defined(NAND_SUPPORT_WRITE)
 static u32 nand_min_page = 0x200; // default to protecting boot1+boot2
 #endif
+#if defined(NAND_SUPPORT_WRITE) && defined(NAND_SUPPORT_ERASE)
+static u8 program_spare[0x80] ALIGNED(128);
+static nand_program* volatile active_program = NULL;
+
+static void __nand_program_next(nand_program* prog);
+#endif
 
 void nand_irq(void)
 {
@@ -68,6 +85,20 @@ void nand_irq(void)
     ahb_flush_from(WB_FLA);
     ahb_flush_to(RB_IOD);
 
+    // Keep the controller busy: hand it the next page of the active ring (if any)
+    // before the waiting CPU even gets to correct the page that just finished.
+    nand_ring* ring = active_ring;
+    if(ring && ring->busy)
+        __nand_ring_complete(ring);
+
+#if defined(NAND_SUPPORT_WRITE) && defined(NAND_SUPPORT_ERASE)
+    nand_program* prog = active_program;
+    if(prog && prog->busy) {
+        if(read32(NAND_CTRL) & NAND_ERROR) prog->error = true;
+        __nand_program_next(prog);
+    }
+#endif
+
     irq_flag = 1;
 }
 
@@ -208,6 +239,7 @@ void nand_write_page(u32 pageno, void *data, void *ecc) {
     if (((s32)data) != -1) dc_flushrange(data, PAGE_SIZE);
     if (((s32)ecc) != -1)  dc_flushrange(ecc, PAGE_SPARE_SIZE);
     ahb_flush_to(RB_FLA);
+    nand_cache_invalidate(pageno, 1);
     __nand_set_address(0, pageno);
     __nand_setup_dma(data, ecc);
     nand_send_command(NAND_WRITE_PRE, 0x1f, NAND_FLAGS_WR, 0x840);
@@ -226,6 +258,7 @@ void nand_erase_block(u32 pageno) {
         printf("Error: nand_erase to page %d forbidden\n", pageno);
         return;
     }
+    nand_cache_invalidate(pageno & ~(BLOCK_SIZE - 1), BLOCK_SIZE);
     __nand_set_address(0, pageno);
     nand_send_command(NAND_ERASE_PRE, 0x1c, 0, 0);
     __nand_wait();
@@ -234,9 +267,80 @@ void nand_erase_block(u32 pageno) {
 }
 #endif
 
+#if defined(NAND_SUPPORT_WRITE) && defined(NAND_SUPPORT_ERASE)
+u32 nand_get_min_page(void)
+{
+    return nand_min_page;
+}
+
+// Must be called from the IRQ handler or with IRQs disabled.
+static void __nand_program_next(nand_program* prog)
+{
+    u32 i = prog->next;
+    while(i < BLOCK_SIZE && !(prog->pages & (1ULL << i))) i++;
+
+    if(i >= BLOCK_SIZE) {
+        active_program = NULL;
+        prog->busy = false;
+        return;
+    }
+
+    // the data is fine where it is, but the spare has to be 128-byte aligned
+    u8* page = prog->data + i * prog->stride;
+    memcpy(program_spare, page + PAGE_SIZE, PAGE_SPARE_SIZE);
+
+    prog->next = i + 1;
+    nand_write_page(prog->pageno + i, page, program_spare);
+}
+
+int nand_program_start(nand_program* prog)
+{
+    if((prog->pageno % BLOCK_SIZE) || prog->pageno < nand_min_page || prog->pageno >= NAND_MAX_PAGE) {
+        printf("Error: nand_program to page %lu forbidden\n", prog->pageno);
+        return -1;
+    }
+
+    // pages that are entirely 0xFF are left erased
+    prog->pages = 0;
+    for(u32 i = 0; i < BLOCK_SIZE; i++) {
+        const u32* words = (const u32*)(prog->data + i * prog->stride);
+        for(u32 j = 0; j < (PAGE_SIZE + PAGE_SPARE_SIZE) / sizeof(u32); j++) {
+            if(words[j] != 0xFFFFFFFF) {
+                prog->pages |= 1ULL << i;
+                break;
+            }
+        }
+    }
+
+    prog->next = 0;
+    prog->error = false;
+    prog->busy = true;
+
+    u32 cookie = irq_kill();
+    active_program = prog;
+    nand_erase_block(prog->pageno);
+    irq_restore(cookie);
+
+    return 0;
+}
+
+int nand_program_wait(nand_program* prog)
+{
+    while(prog->busy) {
+        u32 cookie = irq_kill();
+        if(prog->busy)
+            irq_wait();
+        irq_restore(cookie);
+    }
+
+    return prog->error ? -1 : 0;
+}
+#endif
+
 void nand_initialize(u32 bank)
 {
     if(initialized == bank) return;
+    if(initialized) bank_switches++;
 
     irq_disable(IRQ_NAND);
     nand_reset(bank);
@@ -245,10 +349,283 @@ void nand_initialize(u32 bank)
     initialized = bank;
 }
 
-int nand_correct(u32 pageno, void *data, void *ecc)
+static u8* __nand_ring_data(nand_ring* ring, u32 index)
+{
+    return ring->data + (index % ring->slots) * ring->stride;
+}
+
+// Must be called from the IRQ handler or with IRQs disabled.
+static void __nand_ring_issue(nand_ring* ring)
+{
+    while(!ring->busy) {
+        u32 i = ring->issued;
+
+        if(i >= ring->count) return;
+        // one spare slot stays with the caller until its next nand_ring_wait()
+        if(i - ring->corrected >= NAND_RING_DEPTH - 1) return;
+        if(i - ring->released >= ring->slots) return;
+
+        u32 pageno = ring->pageno + i;
+        u8* ecc = ring_ecc[i % NAND_RING_DEPTH];
+        ring->issued = i + 1;
+
+        // a block we expected to be erased whose first and last pages come back
+        // erased is taken to be erased throughout (pages are programmed in order)
+        if((pageno % BLOCK_SIZE) && ring->skip_block == pageno / BLOCK_SIZE + 1) {
+            memset(ecc, 0xFF, ECC_BUFFER_SIZE);
+            ring_fill[i % NAND_RING_DEPTH] = true;
+            ring->completed = i + 1;
+            continue;
+        }
+
+        ring_fill[i % NAND_RING_DEPTH] = false;
+        ring->busy = true;
+        nand_read_page(pageno, __nand_ring_data(ring, i), ecc);
+    }
+}
+
+static void __nand_ring_complete(nand_ring* ring)
 {
-    (void) pageno;
+    if(ring->probe_block) {
+        u32 block = ring->probe_block - 1;
+        ring->probe_block = 0;
+
+        if(nand_page_erased(probe_ecc))
+            ring->skip_block = block + 1;
+        else
+            printf("NAND: block %lu isn't erased after all, reading all of it\n", block);
+
+        ring->busy = false;
+        __nand_ring_issue(ring);
+        return;
+    }
+
+    u32 i = ring->completed;
+    u32 pageno = ring->pageno + i;
+    ring->completed = i + 1;
+
+    // the ring stays busy while the block's last page is read into the probe
+    // buffer, so nothing past the first page goes out before we know
+    if(ring->erased && !(pageno % BLOCK_SIZE) && ring->erased(pageno / BLOCK_SIZE) &&
+       nand_page_erased(ring_ecc[i % NAND_RING_DEPTH]) && ring->count - i >= BLOCK_SIZE) {
+        ring->probe_block = pageno / BLOCK_SIZE + 1;
+        nand_read_page(pageno + BLOCK_SIZE - 1, probe_data, probe_ecc);
+        return;
+    }
+
+    ring->busy = false;
+    __nand_ring_issue(ring);
+}
+
+static void __nand_ring_kick(nand_ring* ring)
+{
+    u32 cookie = irq_kill();
+    __nand_ring_issue(ring);
+    irq_restore(cookie);
+}
+
+void nand_ring_start(nand_ring* ring)
+{
+    ring->issued = 0;
+    ring->completed = 0;
+    ring->corrected = 0;
+    ring->released = 0;
+    ring->skip_block = 0;
+    ring->probe_block = 0;
+    ring->busy = false;
+
+    u32 cookie = irq_kill();
+    active_ring = ring;
+    __nand_ring_issue(ring);
+    irq_restore(cookie);
+}
+
+int nand_ring_wait(nand_ring* ring, void** data, void** ecc)
+{
+    u32 i = ring->corrected;
+    if(i >= ring->count) return NAND_ECC_UNCORRECTABLE;
+
+// power-saving IRQ wait, restarting the controller if it ran out of slots
+    while(ring->completed <= i) {
+        u32 cookie = irq_kill();
+        __nand_ring_issue(ring);
+        if(ring->completed <= i)
+            irq_wait();
+        irq_restore(cookie);
+    }
 
+// this frees the spare slot of the previous page, so the next read can go out
+// while we are busy correcting this one
+    ring->corrected = i + 1;
+    __nand_ring_kick(ring);
+
+    u8* page_data = __nand_ring_data(ring, i);
+    u8* page_ecc = ring_ecc[i % NAND_RING_DEPTH];
+
+    if(ring_fill[i % NAND_RING_DEPTH])
+        memset(page_data, 0xFF, PAGE_SIZE);
+
+    if(data) *data = page_data;
+    if(ecc) *ecc = page_ecc;
+
+    return nand_correct(ring->pageno + i, page_data, page_ecc);
+}
+
+void nand_ring_release(nand_ring* ring, u32 pages)
+{
+    u32 cookie = irq_kill();
+    ring->released += pages;
+    __nand_ring_issue(ring);
+    irq_restore(cookie);
+}
+
+void nand_ring_stop(nand_ring* ring)
+{
+// let the page in flight land before anybody else touches the controller
+    while(ring->busy) {
+        u32 cookie = irq_kill();
+        if(ring->busy)
+            irq_wait();
+        irq_restore(cookie);
+    }
+
+    active_ring = NULL;
+}
+
+// Corrected pages from nand_read_pages(), keyed by (bank, page). Plain LRU: every
+// hit or fill takes a new stamp, and a miss evicts the slot with the oldest one.
+static u8 cache_data[NAND_CACHE_PAGES][PAGE_SIZE] ALIGNED(64);
+static struct {
+    u32 bank;
+    u32 pageno;
+    u32 stamp;
+    bool valid;
+} cache_tags[NAND_CACHE_PAGES];
+static u32 cache_clock = 0;
+static nand_cache_stats cache_stats = {0};
+
+static int __nand_cache_find(u32 bank, u32 pageno)
+{
+    for(int i = 0; i < NAND_CACHE_PAGES; i++)
+        if(cache_tags[i].valid && cache_tags[i].pageno == pageno && cache_tags[i].bank == bank)
+            return i;
+
+    return -1;
+}
+
+static void __nand_cache_put(u32 pageno, const void* data)
+{
+    int slot = 0;
+    for(int i = 0; i < NAND_CACHE_PAGES; i++) {
+        if(!cache_tags[i].valid) { slot = i; break; }
+        if(cache_tags[i].stamp < cache_tags[slot].stamp) slot = i;
+    }
+
+    memcpy(cache_data[slot], data, PAGE_SIZE);
+    cache_tags[slot].bank = initialized;
+    cache_tags[slot].pageno = pageno;
+    cache_tags[slot].stamp = ++cache_clock;
+    cache_tags[slot].valid = true;
+}
+
+void nand_cache_invalidate(u32 pageno, u32 count)
+{
+    for(int i = 0; i < NAND_CACHE_PAGES; i++)
+        if(cache_tags[i].bank == initialized &&
+           cache_tags[i].pageno >= pageno && cache_tags[i].pageno - pageno < count)
+            cache_tags[i].valid = false;
+}
+
+void nand_get_cache_stats(nand_cache_stats* stats)
+{
+    *stats = cache_stats;
+}
+
+u32 nand_get_bank_switches(void)
+{
+    return bank_switches;
+}
+
+int nand_read_pages(u32 pageno, u32 count, void* data)
+{
+    return nand_read_bank_pages(initialized, pageno, count, data);
+}
+
+int nand_read_bank_pages(u32 bank, u32 pageno, u32 count, void* data)
+{
+    u8* out = data;
+    int res = NAND_ECC_OK;
+
+    for(u32 i = 0; i < count;)
+    {
+        int slot = __nand_cache_find(bank, pageno + i);
+        if(slot >= 0) {
+            memcpy(out + i * PAGE_SIZE, cache_data[slot], PAGE_SIZE);
+            cache_tags[slot].stamp = ++cache_clock;
+            cache_stats.hits++;
+            i++;
+            continue;
+        }
+
+        // only switch banks once something actually has to come from the chip
+        nand_initialize(bank);
+
+        // read the whole run of missing pages in one go
+        u32 run = 1;
+        while(i + run < count && __nand_cache_find(bank, pageno + i + run) < 0) run++;
+
+        nand_ring ring = {
+            .pageno = pageno + i,
+            .count = run,
+            .data = out + i * PAGE_SIZE,
+            .stride = PAGE_SIZE,
+            .slots = run,
+        };
+
+        nand_ring_start(&ring);
+        for(u32 j = 0; j < run; j++)
+        {
+            void* page = NULL;
+            int ecc = nand_ring_wait(&ring, &page, NULL);
+            if(ecc != NAND_ECC_UNCORRECTABLE)
+                __nand_cache_put(pageno + i + j, page);
+
+            if(ecc == NAND_ECC_UNCORRECTABLE || (res != NAND_ECC_UNCORRECTABLE && ecc > res))
+                res = ecc;
+        }
+        nand_ring_stop(&ring);
+
+        cache_stats.misses += run;
+        i += run;
+    }
+
+    return res;
+}
+
+bool nand_page_erased(const void* ecc)
+{
+    const u32* spare = (const u32*)ecc;
+
+    for(int i = 0; i < PAGE_SPARE_SIZE / sizeof(u32); i++)
+        if(spare[i] != 0xFFFFFFFF) return false;
+
+    return true;
+}
+
+static nand_ecc_stats ecc_stats = {0};
+
+void nand_get_ecc_stats(nand_ecc_stats* stats)
+{
+    *stats = ecc_stats;
+}
+
+void nand_reset_ecc_stats(void)
+{
+    memset(&ecc_stats, 0, sizeof(ecc_stats));
+}
+
+int nand_correct(u32 pageno, void *data, void *ecc)
+{
     u8 *dp = (u8*)data;
     u32 *ecc_read = (u32*)((u8*)ecc+0x30);
     u32 *ecc_calc = (u32*)((u8*)ecc+0x40);
@@ -256,36 +633,46 @@ int nand_correct(u32 pageno, void *data, void *ecc)
     int uncorrectable = 0;
     int corrected = 0;
 
-    for(i=0;i<4;i++) {
-        u32 syndrome = *ecc_read ^ *ecc_calc; //calculate ECC syncrome
+    ecc_stats.pages++;
+
+    // the vast majority of pages are clean, check all four syndromes at once
+    if(!((ecc_read[0] ^ ecc_calc[0]) | (ecc_read[1] ^ ecc_calc[1]) |
+         (ecc_read[2] ^ ecc_calc[2]) | (ecc_read[3] ^ ecc_calc[3])))
+        return NAND_ECC_OK;
+
+    for(i=0;i<4;i++,dp+=0x200) {
+        u32 syndrome = ecc_read[i] ^ ecc_calc[i]; //calculate ECC syncrome
         // don't try to correct unformatted pages (all FF)
-        if ((*ecc_read != 0xFFFFFFFF) && syndrome) {
-            if(!((syndrome-1)&syndrome)) {
-                // single-bit error in ECC
-                corrected++;
-            } else {
-                // byteswap and extract odd and even halves
-                u16 even = (syndrome >> 24) | ((syndrome >> 8) & 0xf00);
-                u16 odd = ((syndrome << 8) & 0xf00) | ((syndrome >> 8) & 0x0ff);
-                if((even ^ odd) != 0xfff) {
-                    // oops, can't fix this one
-                    uncorrectable++;
-                } else {
-                    // fix the bad bit
-                    dp[odd >> 3] ^= 1<<(odd&7);
-                    corrected++;
-                }
-            }
+        if (!syndrome || ecc_read[i] == 0xFFFFFFFF)
+            continue;
+
+        if(!((syndrome-1)&syndrome)) {
+            // single-bit error in ECC
+            corrected++;
+        } else if(((syndrome ^ (syndrome >> 16)) & 0xFF0F) == 0xFF0F) {
+            // the byteswapped even and odd 12-bit halves are complements of each
+            // other, which means the odd half is the position of a single bad bit
+            u32 bit = ((syndrome & 0xF) << 8) | ((syndrome >> 8) & 0xFF);
+            dp[bit >> 3] ^= 1<<(bit&7);
+            corrected++;
+        } else {
+            // oops, can't fix this one
+            uncorrectable++;
         }
-        dp += 0x200;
-        ecc_read++;
-        ecc_calc++;
     }
-    if(uncorrectable || corrected)
-        printf("ECC stats for NAND page 0x%lX: %d uncorrectable, %d corrected\n", pageno, uncorrectable, corrected);
-    if(uncorrectable)
+
+    ecc_stats.subpages_corrected += corrected;
+    ecc_stats.subpages_uncorrectable += uncorrectable;
+
+    NAND_debug("ECC stats for NAND page 0x%lX: %d uncorrectable, %d corrected\n", pageno, uncorrectable, corrected);
+    if(uncorrectable) {
+        ecc_stats.uncorrectable++;
+        ecc_stats.last_uncorrectable = pageno;
         return NAND_ECC_UNCORRECTABLE;
-    if(corrected)
+    }
+    if(corrected) {
+        ecc_stats.corrected++;
         return NAND_ECC_CORRECTED;
+    }
     return NAND_ECC_OK;
 }
@@ -16,12 +16,17 @@
 
 #include "types.h"
 
+// Needed for SLC restore. Pages below nand_min_page (boot1/boot2) are still refused.
+#define NAND_SUPPORT_WRITE 1
+#define NAND_SUPPORT_ERASE 1
+
 #define PAGE_SIZE       2048
 #define PAGE_SPARE_SIZE     64
 #define ECC_BUFFER_SIZE     (PAGE_SPARE_SIZE+16)
 #define ECC_BUFFER_ALLOC    (PAGE_SPARE_SIZE+32)
 #define BLOCK_SIZE      64
 #define NAND_MAX_PAGE       0x40000
+#define NAND_MAX_BLOCK      (NAND_MAX_PAGE / BLOCK_SIZE)
 
 #define NAND_BANK_SLCCMPT 0x00000001
 #define NAND_BANK_SLC 0x00000002
@@ -39,12 +44,105 @@ void nand_write_page(u32 pageno, void *data, void *ecc);
 void nand_erase_block(u32 pageno);
 void nand_wait(void);
 
+#if defined(NAND_SUPPORT_WRITE) && defined(NAND_SUPPORT_ERASE)
+// Erases the block at `pageno` and programs it from nand_irq(), a page per interrupt,
+// so the CPU is free until nand_program_wait(). `data` holds BLOCK_SIZE pages `stride`
+// bytes apart, each with its spare right after the data (the .RAW layout). Pages that
+// are entirely 0xFF are left erased. Can't be used while a nand_ring is active.
+typedef struct {
+    u32 pageno;
+    u8* data;
+    u32 stride;
+
+    u64 pages;
+    volatile u32 next;
+    volatile bool busy;
+    volatile bool error;
+} nand_program;
+
+u32 nand_get_min_page(void);
+int nand_program_start(nand_program* prog);
+int nand_program_wait(nand_program* prog);
+#endif
+
+// Depth of the pipelined read engine, i.e. how far the controller may run ahead
+// of ECC correction. A few whole blocks, so a dump can read the next ones while
+// the CPU is busy with the last (e.g. compressing them, or writing them to FAT).
+#define NAND_RING_DEPTH     (4 * BLOCK_SIZE)
+
+// Pipelined multi-page read. Pages pageno..pageno+count-1 are DMA'd into a ring of
+// `slots` data buffers, `stride` bytes apart (both must keep 64-byte alignment).
+// The next page is issued from nand_irq() while the CPU corrects the previous one,
+// and a data slot is only reused once the caller hands it back with
+// nand_ring_release(). Only one ring can be active at a time.
+// If `erased` is set, blocks it returns true for are read up to their first page;
+// when that and the block's last page both come back erased, the pages in between
+// are filled in as erased. That's only for dumps that rebuild the hint as they go,
+// never for verifies or anything that writes back what it reads.
+typedef struct {
+    u32 pageno;
+    u32 count;
+    u8* data;
+    u32 stride;
+    u32 slots;
+    bool (*erased)(u32 block);
+
+    volatile u32 issued;
+    volatile u32 completed;
+    volatile u32 corrected;
+    volatile u32 released;
+    volatile u32 skip_block;
+    volatile u32 probe_block;
+    volatile bool busy;
+} nand_ring;
+
+void nand_ring_start(nand_ring* ring);
+int nand_ring_wait(nand_ring* ring, void** data, void** ecc);
+void nand_ring_release(nand_ring* ring, u32 pages);
+void nand_ring_stop(nand_ring* ring);
+
+// Number of corrected pages nand_read_pages() keeps around (2KiB each). Enough
+// for a whole ISFS superblock (0x80 pages) plus the candidates scanned to find it.
+#define NAND_CACHE_PAGES    256
+
+// Reads through the page cache. Write paths must nand_cache_invalidate() what
+// they touch; dumps use nand_ring directly and bypass it.
+int nand_read_pages(u32 pageno, u32 count, void* data);
+// Same, but for any bank. The controller is only switched over (and reset) if some
+// of the pages aren't cached.
+int nand_read_bank_pages(u32 bank, u32 pageno, u32 count, void* data);
+
+typedef struct {
+    u32 hits;
+    u32 misses;
+} nand_cache_stats;
+
+void nand_cache_invalidate(u32 pageno, u32 count);
+void nand_get_cache_stats(nand_cache_stats* stats);
+
 #define NAND_ECC_OK 0
 #define NAND_ECC_CORRECTED 1
 #define NAND_ECC_UNCORRECTABLE -1
 
 int nand_correct(u32 pageno, void *data, void *ecc);
+bool nand_page_erased(const void* ecc);
+
+// Running totals kept by nand_correct(), so long passes don't have to print every
+// corrected page.
+typedef struct {
+    u32 pages;
+    u32 corrected;
+    u32 uncorrectable;
+    u32 subpages_corrected;
+    u32 subpages_uncorrectable;
+    u32 last_uncorrectable;
+} nand_ecc_stats;
+
+void nand_get_ecc_stats(nand_ecc_stats* stats);
+void nand_reset_ecc_stats(void);
 void nand_initialize(u32 bank);
+// Number of times nand_initialize() had to reset the controller for another bank.
+u32 nand_get_bank_switches(void);
 
 #endif
 
@@ -0,0 +1,252 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *  Copyright (C) 2016          Daz Jones <daz@dazzozo.com>
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#include "nand_map.h"
+#include "nand.h"
+#include "utils.h"
+#include "gfx.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define NAND_MAP_MAGIC      0x4E4D4150 // "NMAP"
+#define NAND_MAP_VERSION    1
+
+typedef struct {
+    u32 magic;
+    u32 version;
+    u32 bank;
+    u8 chip_id[8];
+    u8 blocks[NAND_MAX_BLOCK];
+} nand_map_t;
+
+static struct {
+    bool loaded;
+    nand_map_t map;
+} maps[2] = {0};
+
+static struct {
+    nand_map_t* map;
+    u8 blocks[NAND_MAX_BLOCK];
+    // per-block ECC histogram, in pages (at most BLOCK_SIZE each)
+    u8 corrected[NAND_MAX_BLOCK];
+    u8 uncorrectable[NAND_MAX_BLOCK];
+    u8 erased_pages;
+    bool active;
+} pass = {0};
+
+static u8 id_buf[0x40] ALIGNED(64);
+
+static int _nand_map_index(u32 bank)
+{
+    switch(bank) {
+        case NAND_BANK_SLC: return 0;
+        case NAND_BANK_SLCCMPT: return 1;
+        default: return -1;
+    }
+}
+
+static const char* _nand_map_path(u32 bank)
+{
+    return bank == NAND_BANK_SLC ? "sdmc:/minute/slc.map" : "sdmc:/minute/slccmpt.map";
+}
+
+static const char* _nand_map_report_path(u32 bank)
+{
+    return bank == NAND_BANK_SLC ? "sdmc:/minute/ecc-slc.csv" : "sdmc:/minute/ecc-slccmpt.csv";
+}
+
+static void _nand_map_read_id(u32 bank, u8* chip_id)
+{
+    nand_initialize(bank);
+    nand_get_id(id_buf);
+    nand_wait();
+
+    memcpy(chip_id, id_buf, sizeof(((nand_map_t*)0)->chip_id));
+}
+
+static nand_map_t* _nand_map_load(u32 bank)
+{
+    int index = _nand_map_index(bank);
+    if(index < 0) return NULL;
+
+    nand_map_t* map = &maps[index].map;
+    if(maps[index].loaded) return map;
+
+    u8 chip_id[sizeof(map->chip_id)];
+    _nand_map_read_id(bank, chip_id);
+
+    memset(map, 0, sizeof(*map));
+    maps[index].loaded = true;
+
+    FILE* file = fopen(_nand_map_path(bank), "rb");
+    if(file) {
+        int count = fread(map, sizeof(*map), 1, file);
+        fclose(file);
+
+        if(count != 1 || map->magic != NAND_MAP_MAGIC || map->version != NAND_MAP_VERSION ||
+           map->bank != bank) {
+            printf("NAND: Ignoring invalid block map %s.\n", _nand_map_path(bank));
+            memset(map->blocks, NAND_BLOCK_UNKNOWN, sizeof(map->blocks));
+        } else if(memcmp(map->chip_id, chip_id, sizeof(chip_id))) {
+            printf("NAND: Block map %s is for a different chip, discarding.\n", _nand_map_path(bank));
+            memset(map->blocks, NAND_BLOCK_UNKNOWN, sizeof(map->blocks));
+        }
+    }
+
+    map->magic = NAND_MAP_MAGIC;
+    map->version = NAND_MAP_VERSION;
+    map->bank = bank;
+    memcpy(map->chip_id, chip_id, sizeof(chip_id));
+
+    return map;
+}
+
+static int _nand_map_save(nand_map_t* map)
+{
+    mkdir("sdmc:/minute", 0777);
+
+    const char* path = _nand_map_path(map->bank);
+    FILE* file = fopen(path, "wb");
+    if(!file) {
+        printf("NAND: Failed to open %s.\n", path);
+        return -1;
+    }
+
+    int count = fwrite(map, sizeof(*map), 1, file);
+    int res = fclose(file);
+    if(count != 1 || res) {
+        printf("NAND: Failed to write %s.\n", path);
+        return -2;
+    }
+
+    return 0;
+}
+
+static int _nand_map_save_report(u32 bank)
+{
+    static const char* states[] = {"unknown", "good", "erased", "bad"};
+
+    const char* path = _nand_map_report_path(bank);
+    FILE* file = fopen(path, "w");
+    if(!file) {
+        printf("NAND: Failed to open %s.\n", path);
+        return -1;
+    }
+
+    fprintf(file, "block,state,corrected,uncorrectable\n");
+    for(u32 i = 0; i < NAND_MAX_BLOCK; i++)
+        fprintf(file, "%lu,%s,%u,%u\n", i, states[pass.blocks[i]], pass.corrected[i], pass.uncorrectable[i]);
+
+    if(fclose(file)) {
+        printf("NAND: Failed to write %s.\n", path);
+        return -2;
+    }
+
+    return 0;
+}
+
+int nand_map_get(u32 bank, u32 block)
+{
+    if(block >= NAND_MAX_BLOCK) return NAND_BLOCK_UNKNOWN;
+
+    nand_map_t* map = _nand_map_load(bank);
+    if(!map) return NAND_BLOCK_UNKNOWN;
+
+    return map->blocks[block];
+}
+
+void nand_map_set(u32 bank, u32 block, int state)
+{
+    if(block >= NAND_MAX_BLOCK) return;
+
+    nand_map_t* map = _nand_map_load(bank);
+    if(map) map->blocks[block] = state;
+}
+
+int nand_map_save(u32 bank)
+{
+    nand_map_t* map = _nand_map_load(bank);
+    if(!map) return -1;
+
+    return _nand_map_save(map);
+}
+
+void nand_map_pass_begin(u32 bank)
+{
+    pass.map = _nand_map_load(bank);
+    pass.active = pass.map != NULL;
+    pass.erased_pages = 0;
+    // blocks the pass doesn't get to (e.g. a resumed dump) keep what was known
+    if(pass.map) memcpy(pass.blocks, pass.map->blocks, sizeof(pass.blocks));
+    else memset(pass.blocks, NAND_BLOCK_UNKNOWN, sizeof(pass.blocks));
+    memset(pass.corrected, 0, sizeof(pass.corrected));
+    memset(pass.uncorrectable, 0, sizeof(pass.uncorrectable));
+}
+
+void nand_map_pass_page(u32 pageno, int ecc_res, const void* ecc)
+{
+    if(!pass.active || pageno >= NAND_MAX_PAGE) return;
+
+    u32 block = pageno / BLOCK_SIZE;
+    u32 page = pageno % BLOCK_SIZE;
+
+    if(ecc_res == NAND_ECC_CORRECTED) pass.corrected[block]++;
+    if(ecc_res == NAND_ECC_UNCORRECTABLE) pass.uncorrectable[block]++;
+
+    if(page == 0) {
+        pass.erased_pages = 0;
+        pass.blocks[block] = NAND_BLOCK_UNKNOWN;
+        // factory bad block marker is the first spare byte of the first page
+        if(((const u8*)ecc)[0] != 0xFF) {
+            pass.blocks[block] = NAND_BLOCK_BAD;
+            return;
+        }
+    }
+    if(pass.blocks[block] == NAND_BLOCK_BAD) return;
+
+    if(ecc_res != NAND_ECC_UNCORRECTABLE && nand_page_erased(ecc))
+        pass.erased_pages++;
+
+    if(page == BLOCK_SIZE - 1)
+        pass.blocks[block] = pass.erased_pages == BLOCK_SIZE ? NAND_BLOCK_ERASED : NAND_BLOCK_GOOD;
+}
+
+int nand_map_pass_end(void)
+{
+    if(!pass.active) return -1;
+    pass.active = false;
+
+    u32 bad = 0, erased = 0;
+    for(u32 i = 0; i < NAND_MAX_BLOCK; i++) {
+        if(pass.blocks[i] == NAND_BLOCK_BAD) bad++;
+        if(pass.blocks[i] == NAND_BLOCK_ERASED) erased++;
+    }
+
+    memcpy(pass.map->blocks, pass.blocks, sizeof(pass.blocks));
+    printf("NAND: %lu bad, %lu erased blocks.\n", bad, erased);
+
+    int res = _nand_map_save(pass.map);
+    if(res) return res;
+
+    return _nand_map_save_report(pass.map->bank);
+}
+
+void nand_map_pass_cancel(void)
+{
+    pass.active = false;
+}
+
+bool nand_map_pass_erased(u32 block)
+{
+    if(!pass.active || block >= NAND_MAX_BLOCK) return false;
+    return pass.map->blocks[block] == NAND_BLOCK_ERASED;
+}
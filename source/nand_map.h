@@ -0,0 +1,41 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *  Copyright (C) 2016          Daz Jones <daz@dazzozo.com>
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#ifndef _NAND_MAP_H
+#define _NAND_MAP_H
+
+#include "types.h"
+
+// Per-block state for the SLC banks, built up during full passes over a bank and
+// cached on SD (sdmc:/minute/<bank>.map) keyed by the chip ID, so later passes can
+// skip bad blocks and avoid reading erased ones.
+#define NAND_BLOCK_UNKNOWN  0
+#define NAND_BLOCK_GOOD     1
+#define NAND_BLOCK_ERASED   2
+#define NAND_BLOCK_BAD      3
+
+int nand_map_get(u32 bank, u32 block);
+// For callers that change blocks outside of a pass (e.g. restore).
+void nand_map_set(u32 bank, u32 block, int state);
+int nand_map_save(u32 bank);
+
+// Record a full pass over a bank: every page from nand_ring_wait(), in order.
+// pass_end() replaces the stored map with what was seen and saves it, along with
+// a per-block ECC report in sdmc:/minute/ecc-<bank>.csv.
+void nand_map_pass_begin(u32 bank);
+void nand_map_pass_page(u32 pageno, int ecc_res, const void* ecc);
+int nand_map_pass_end(void);
+// Drops a pass that didn't make it to the end, leaving the stored map as it was.
+void nand_map_pass_cancel(void);
+
+// nand_ring erased hint for the bank of the current pass, false outside of one.
+bool nand_map_pass_erased(u32 block);
+
+#endif
@@ -0,0 +1,294 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *  Copyright (C) 2016          Daz Jones <daz@dazzozo.com>
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#include "pipeline.h"
+#include "progress.h"
+#include "utils.h"
+#include "gfx.h"
+
+#include <malloc.h>
+#include <string.h>
+
+// A pipeline in progress.
+typedef struct {
+    pipeline* pipe;
+    u8* bufs[PIPELINE_MAX_DEPTH];
+
+    // chunks read (into bufs[n % depth]) and written so far
+    u32 chunks, rd, wr, tapped;
+    u32 rd_tries, wr_tries;
+
+    // what's in flight this step
+    bool reading, writing;
+    int rres, wres;
+    u32 stamp;
+
+    progress prog;
+} pipeline_state;
+
+static void _pipeline_free(pipeline_state* st)
+{
+    for(u32 i = 0; i < PIPELINE_MAX_DEPTH; i++)
+        free(st->bufs[i]);
+}
+
+static int _pipeline_open(pipeline_state* st, pipeline* pipe, int line)
+{
+    memset(st, 0, sizeof(*st));
+
+    if(pipe->depth < 2 || pipe->depth > PIPELINE_MAX_DEPTH || !pipe->chunk) return -1;
+    if(pipe->start % pipe->chunk) return -1;
+
+    if(pipe->open) {
+        int res = pipe->open(pipe->open_ctx);
+        if(res) {
+            printf("%s: Failed to start (%d).\n", pipe->name, res);
+            return -6;
+        }
+    }
+
+    for(u32 i = 0; i < pipe->depth; i++) {
+        st->bufs[i] = memalign(PIPELINE_BUF_ALIGN, pipe->chunk * pipe->block_size);
+        if(!st->bufs[i]) {
+            printf("%s: Out of memory.\n", pipe->name);
+            _pipeline_free(st);
+            if(pipe->close) pipe->close(pipe->close_ctx, -2);
+            return -2;
+        }
+    }
+
+    st->chunks = (pipe->total + pipe->chunk - 1) / pipe->chunk;
+    st->rd = st->wr = st->tapped = pipe->start / pipe->chunk;
+
+    progress_begin(&st->prog, pipe->name, (u64)pipe->start * pipe->block_size, (u64)pipe->total * pipe->block_size);
+    st->prog.line = line;
+
+    st->pipe = pipe;
+    return 0;
+}
+
+static void _pipeline_close(pipeline_state* st, int res)
+{
+    pipeline* pipe = st->pipe;
+
+    // don't leave a stale status line behind on failure
+    if(res) gfx_draw_status(st->prog.line, "");
+    else progress_end(&st->prog);
+
+    _pipeline_free(st);
+    if(pipe->close) pipe->close(pipe->close_ctx, res);
+    st->pipe = NULL;
+}
+
+// Starts reading the next chunk, if there's a free buffer for it.
+static void _pipeline_start_read(pipeline_state* st)
+{
+    pipeline* pipe = st->pipe;
+    u32 offset = st->rd * pipe->chunk;
+
+    st->reading = st->rd < st->chunks && (st->rd - st->wr) < pipe->depth;
+    st->writing = false;
+    st->rres = st->wres = 0;
+
+    // time spent in each call goes to its stage, so whichever side is
+    // slower ends up with the time spent waiting for it
+    st->stamp = progress_stamp();
+
+    if(st->reading)
+        st->rres = pipe->source.start(pipe->source.ctx, offset, min(pipe->chunk, pipe->total - offset),
+                                      st->bufs[st->rd % pipe->depth]);
+    st->stamp = progress_account(&st->prog, PROGRESS_SOURCE, st->stamp);
+}
+
+static bool _pipeline_waiting(pipeline_state* st)
+{
+    return st->wr < st->rd;
+}
+
+// Starts writing the oldest chunk read, after _pipeline_start_read().
+static void _pipeline_start_write(pipeline_state* st)
+{
+    pipeline* pipe = st->pipe;
+    u32 offset = st->wr * pipe->chunk;
+    u32 count = min(pipe->chunk, pipe->total - offset);
+    u8* buf = st->bufs[st->wr % pipe->depth];
+
+    st->writing = true;
+    st->stamp = progress_stamp();
+
+    st->wres = pipe->sink.start(pipe->sink.ctx, offset, count, buf);
+    st->stamp = progress_account(&st->prog, PROGRESS_SINK, st->stamp);
+
+    // the chunk being written can't change any more, so look at it while
+    // both transfers are in flight (only once, even if the write is retried)
+    if(pipe->tap && st->tapped == st->wr) {
+        pipe->tap(pipe->tap_ctx, buf, count * pipe->block_size);
+        st->tapped++;
+    }
+    st->stamp = progress_account(&st->prog, PROGRESS_TAP, st->stamp);
+}
+
+static int _pipeline_flush_stage(pipeline_stage* stage)
+{
+    return stage->flush ? stage->flush(stage->ctx) : 0;
+}
+
+// Ends anything the stages kept going, once every chunk is written.
+static int _pipeline_flush(pipeline_state* st)
+{
+    pipeline* pipe = st->pipe;
+
+    int rres = _pipeline_flush_stage(&pipe->source);
+    int wres = _pipeline_flush_stage(&pipe->sink);
+    if(wres) {
+        printf("%s: Failed to finish writing (%d).\n", pipe->name, wres);
+        return -4;
+    }
+    if(rres) {
+        printf("%s: Failed to finish reading (%d).\n", pipe->name, rres);
+        return -3;
+    }
+
+    return 0;
+}
+
+// Waits for whatever was started, and moves on or retries.
+static int _pipeline_finish(pipeline_state* st)
+{
+    pipeline* pipe = st->pipe;
+    u32 rd_offset = st->rd * pipe->chunk, wr_offset = st->wr * pipe->chunk;
+
+    u32 stamp = progress_stamp();
+    if(st->reading && st->rres == 0)
+        st->rres = pipe->source.end(pipe->source.ctx);
+    stamp = progress_account(&st->prog, PROGRESS_SOURCE, stamp);
+    if(st->writing && st->wres == 0)
+        st->wres = pipe->sink.end(pipe->sink.ctx);
+    progress_account(&st->prog, PROGRESS_SINK, stamp);
+
+    if(st->reading) {
+        if(st->rres == 0) {
+            st->rd++;
+            st->rd_tries = 0;
+        } else if(++st->rd_tries >= pipe->retries) {
+            printf("%s: Failed to read 0x%08lX (%d).\n", pipe->name, rd_offset, st->rres);
+            return -3;
+        }
+    }
+
+    if(st->writing) {
+        if(st->wres == 0) {
+            st->wr++;
+            st->wr_tries = 0;
+
+            u32 done = min(wr_offset + pipe->chunk, pipe->total);
+            progress_update(&st->prog, (u64)done * pipe->block_size);
+
+            if(pipe->checkpoint && ((done % pipe->checkpoint_every) == 0 || done == pipe->total)) {
+                // what the checkpoint records has to be on the sink first
+                int res = _pipeline_flush_stage(&pipe->sink);
+                if(res == 0) res = pipe->checkpoint(pipe->checkpoint_ctx, done);
+                if(res) {
+                    printf("%s: Checkpoint at 0x%08lX failed (%d).\n", pipe->name, done, res);
+                    return -5;
+                }
+            }
+        } else if(++st->wr_tries >= pipe->retries) {
+            printf("%s: Failed to write 0x%08lX (%d).\n", pipe->name, wr_offset, st->wres);
+            return -4;
+        }
+    }
+
+    return 0;
+}
+
+int pipeline_run(pipeline* pipe)
+{
+    return pipeline_run_lanes(&pipe, 1);
+}
+
+int pipeline_run_lanes(pipeline** lanes, u32 count)
+{
+    if(count > PIPELINE_MAX_LANES) return -1;
+
+    pipeline_state states[PIPELINE_MAX_LANES];
+    pipeline* next[PIPELINE_MAX_LANES];
+    int res = 0;
+
+    // the lane whose sink is writing, and how many chunks it's written in a row
+    pipeline_state* writer = NULL;
+    u32 turn = 0;
+
+    for(u32 i = 0; i < count; i++) {
+        states[i].pipe = NULL;
+        next[i] = lanes[i];
+    }
+
+    while(true)
+    {
+        // lanes move on to their next pipeline as soon as one is done
+        bool running = false;
+        for(u32 i = 0; i < count && !res; i++) {
+            if(!states[i].pipe && next[i]) {
+                res = _pipeline_open(&states[i], next[i], i);
+                next[i] = next[i]->next;
+            }
+            if(states[i].pipe) running = true;
+        }
+        if(res || !running) break;
+
+        // every source reads at once, but the sinks share a device, so only
+        // one of them writes at a time. Switching ends one sink's transfer and
+        // starts the other's (for SD, a CMD12 and a new stream), so a lane keeps
+        // writing while it has chunks waiting, for up to a turn, and then it's
+        // the turn of the other lane with the most chunks waiting
+        for(u32 i = 0; i < count; i++)
+            if(states[i].pipe) _pipeline_start_read(&states[i]);
+
+        if(!writer || !writer->pipe || !_pipeline_waiting(writer) || turn >= PIPELINE_LANE_TURN) {
+            pipeline_state* last = writer;
+            writer = NULL;
+            for(u32 i = 0; i < count; i++) {
+                pipeline_state* st = &states[i];
+                if(!st->pipe || !_pipeline_waiting(st) || st == last) continue;
+                if(!writer || st->rd - st->wr > writer->rd - writer->wr)
+                    writer = st;
+            }
+            // nobody else has anything, so it's another turn for the last one
+            if(!writer && last && last->pipe && _pipeline_waiting(last))
+                writer = last;
+            turn = 0;
+        }
+        if(writer) {
+            _pipeline_start_write(writer);
+            turn++;
+        }
+
+        // everything in flight has to be waited for, even after a failure
+        for(u32 i = 0; i < count; i++) {
+            pipeline_state* st = &states[i];
+            if(!st->pipe) continue;
+
+            int lane_res = _pipeline_finish(st);
+            if(lane_res && !res) res = lane_res;
+
+            if(!res && st->wr >= st->chunks) {
+                res = _pipeline_flush(st);
+                if(!res) _pipeline_close(st, 0);
+            }
+        }
+        if(res) break;
+    }
+
+    for(u32 i = 0; i < count; i++)
+        if(states[i].pipe) _pipeline_close(&states[i], res);
+
+    return res;
+}
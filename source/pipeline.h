@@ -0,0 +1,95 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *  Copyright (C) 2016          Daz Jones <daz@dazzozo.com>
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#ifndef _PIPELINE_H
+#define _PIPELINE_H
+
+#include "types.h"
+
+// One end of a copy. start() kicks off a transfer of `count` blocks at `offset`
+// (in the pipeline's blocks, from the start of the copy) to or from `buf`, and
+// end() waits for it. Stages that can't run in the background just do the work
+// in start() and return the result from end(). Either returning non-zero retries
+// the same chunk. flush() is optional, for stages that keep a transfer going past
+// end(): it ends that, which for a sink makes everything written so far stick,
+// and is called before every checkpoint and once the copy is done.
+typedef struct {
+    int (*start)(void* ctx, u32 offset, u32 count, void* buf);
+    int (*end)(void* ctx);
+    void* ctx;
+    int (*flush)(void* ctx);
+} pipeline_stage;
+
+// Copies `total` blocks of `block_size` bytes from source to sink, `chunk` blocks
+// at a time. The source keeps filling up to `depth` buffers (at least 2) while the
+// sink drains them, so the two overlap, and either one can fall behind (e.g. while
+// retrying) without stalling the other until the buffers run out. Progress and
+// the time spent in each stage are shown on the status line.
+typedef struct pipeline {
+    const char* name;
+    pipeline_stage source;
+    pipeline_stage sink;
+
+    u32 total;
+    u32 block_size;
+    u32 chunk;
+    u32 depth;
+    // blocks already copied by an earlier run, a multiple of chunk
+    u32 start;
+
+    // attempts per chunk and stage before giving up
+    u32 retries;
+
+    // optional, called with the number of blocks safely written every
+    // `checkpoint_every` blocks (a multiple of chunk) and at the end; non-zero
+    // aborts the copy
+    int (*checkpoint)(void* ctx, u32 done);
+    void* checkpoint_ctx;
+    u32 checkpoint_every;
+
+    // optional, sees every chunk once, in order, while the sink is writing it and
+    // the source is reading the next one (e.g. for hashing)
+    void (*tap)(void* ctx, const void* buf, u32 size);
+    void* tap_ctx;
+
+    // optional, called right before the copy starts (non-zero aborts it) and,
+    // if that went fine, right after it ends with the result, for setup that
+    // has to wait its turn when pipelines run one after the other
+    int (*open)(void* ctx);
+    void* open_ctx;
+    void (*close)(void* ctx, int res);
+    void* close_ctx;
+
+    // what runs next in the same lane, see pipeline_run_lanes()
+    struct pipeline* next;
+} pipeline;
+
+#define PIPELINE_MAX_DEPTH  8
+// buffers are aligned so SD/MLC stages can stream straight out of them, see
+// struct sdhc_stream
+#define PIPELINE_BUF_ALIGN  (32 * 1024)
+// one status line each, see GFX_STATUS_LINES
+#define PIPELINE_MAX_LANES  2
+// chunks a lane's sink writes in a row before another lane's gets a turn
+#define PIPELINE_LANE_TURN  16
+
+int pipeline_run(pipeline* pipe);
+
+// Runs several lanes of pipelines (each lane following `next`) side by side.
+// The sources of all lanes read at the same time, so they have to be separate
+// devices, while the sinks are assumed to share one and take turns of up to
+// PIPELINE_LANE_TURN chunks, the lane with the most chunks waiting going next.
+// Each turn costs the sinks a restart (an SD stream is closed and another one
+// opened), which the turns spread over that many chunks; a source whose buffers
+// fill up meanwhile waits. As long as the sink keeps up, the longest lane hides
+// the others. The first failure stops every lane.
+int pipeline_run_lanes(pipeline** lanes, u32 count);
+
+#endif
@@ -0,0 +1,120 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *  Copyright (C) 2016          Daz Jones <daz@dazzozo.com>
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#include "progress.h"
+#include "utils.h"
+#include "latte.h"
+#include "gfx.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const char* stage_names[PROGRESS_STAGES] = {
+    [PROGRESS_SOURCE] = "source",
+    [PROGRESS_SINK] = "sink",
+    [PROGRESS_TAP] = "tap",
+};
+
+static void _progress_tick(progress* p)
+{
+    u32 now = read32(LT_TIMER);
+    p->elapsed += now - p->last;
+    p->last = now;
+}
+
+static void _progress_time(char* str, u64 ms)
+{
+    u32 s = ms / 1000;
+    sprintf(str, "%lu:%02lu:%02lu", s / 3600, (s / 60) % 60, s % 60);
+}
+
+// bytes per millisecond, which happens to be kB/s
+static u32 _progress_rate(progress* p)
+{
+    u64 ms = p->elapsed / PROGRESS_TICKS_PER_MS;
+    if(!ms) return 0;
+
+    return (p->done - p->skipped) / ms;
+}
+
+// share of the elapsed time each stage took, if any were timed
+static int _progress_stages(progress* p, char* str)
+{
+    int len = 0;
+    if(!p->elapsed) return 0;
+
+    for(int i = 0; i < PROGRESS_STAGES; i++) {
+        if(!p->stages[i]) continue;
+        len += sprintf(str + len, "%s%s %lu%%", len ? ", " : " [", stage_names[i],
+                       (u32)(p->stages[i] * 100 / p->elapsed));
+    }
+    if(len) len += sprintf(str + len, "]");
+
+    return len;
+}
+
+void progress_begin(progress* p, const char* name, u64 done, u64 total)
+{
+    memset(p, 0, sizeof(*p));
+
+    p->name = name;
+    p->total = total;
+    p->done = done;
+    p->skipped = done;
+    p->last = read32(LT_TIMER);
+}
+
+void progress_update(progress* p, u64 done)
+{
+    p->done = done;
+    _progress_tick(p);
+
+    if(p->elapsed - p->drawn < PROGRESS_REDRAW_MS * PROGRESS_TICKS_PER_MS) return;
+    p->drawn = p->elapsed;
+
+    char line[256], eta[16] = "?";
+    u32 rate = _progress_rate(p);
+    if(rate) _progress_time(eta, (p->total - p->done) / rate);
+
+    int len = sprintf(line, "%s: %lu%% of %lu MB, %lu.%lu MB/s, ETA %s", p->name,
+                      (u32)(p->total ? p->done * 100 / p->total : 100), (u32)(p->total / 1000000),
+                      rate / 1000, (rate % 1000) / 100, eta);
+    _progress_stages(p, line + len);
+
+    gfx_draw_status(p->line, line);
+}
+
+void progress_end(progress* p)
+{
+    _progress_tick(p);
+    gfx_draw_status(p->line, "");
+
+    char line[256], took[16];
+    u32 rate = _progress_rate(p);
+    _progress_time(took, p->elapsed / PROGRESS_TICKS_PER_MS);
+
+    int len = sprintf(line, "%s: %lu MB in %s, %lu.%lu MB/s", p->name,
+                      (u32)((p->done - p->skipped) / 1000000), took, rate / 1000, (rate % 1000) / 100);
+    _progress_stages(p, line + len);
+
+    printf("%s\n", line);
+}
+
+u32 progress_stamp(void)
+{
+    return read32(LT_TIMER);
+}
+
+u32 progress_account(progress* p, u32 stage, u32 stamp)
+{
+    u32 now = read32(LT_TIMER);
+    p->stages[stage] += now - stamp;
+    return now;
+}
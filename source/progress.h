@@ -0,0 +1,58 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *  Copyright (C) 2016          Daz Jones <daz@dazzozo.com>
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#ifndef _PROGRESS_H
+#define _PROGRESS_H
+
+#include "types.h"
+
+// LT_TIMER runs at ~1.9 MHz (see udelay) and wraps every ~37 minutes, so time is
+// accumulated in 64 bits from short deltas.
+#define PROGRESS_TICKS_PER_MS   (1900)
+#define PROGRESS_REDRAW_MS      (500)
+
+// where a copy spends its time
+enum {
+    PROGRESS_SOURCE,
+    PROGRESS_SINK,
+    PROGRESS_TAP,
+    PROGRESS_STAGES
+};
+
+// Rate, ETA and time per stage of a long copy, shown on the status line at the
+// bottom of the screen.
+typedef struct {
+    const char* name;
+    u64 total;
+    u64 done;
+    // bytes that were already done when we started, e.g. on resume
+    u64 skipped;
+
+    u64 elapsed;
+    u64 stages[PROGRESS_STAGES];
+    u32 last;
+    u64 drawn;
+
+    // which status line to draw on, 0 unless copies run side by side
+    int line;
+} progress;
+
+// `done` and `total` are in bytes.
+void progress_begin(progress* p, const char* name, u64 done, u64 total);
+void progress_update(progress* p, u64 done);
+// Clears the status line and prints a summary.
+void progress_end(progress* p);
+
+// For timing stages: `stamp` is what the previous call (or progress_stamp())
+// returned, so back-to-back calls account for every tick without gaps.
+u32 progress_stamp(void);
+u32 progress_account(progress* p, u32 stage, u32 stamp);
+
+#endif
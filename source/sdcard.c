@@ -44,6 +44,11 @@ struct sdcard_ctx {
 
     u32 num_sectors;
     u16 rca;
+
+    // what erased blocks read back as, or -1 if the card can't erase
+    int erased_value;
+
+    u32 cid[4];
 };
 
 static struct sdcard_ctx card;
@@ -75,6 +80,38 @@ void sdcard_abort(void) {
     sdhc_exec_command(card.handle, &cmd);
 }
 
+// Switches the card to high speed timing (access mode SDR25), which has to be
+// checked for with CMD6 first. Non-zero if the card stays at default speed.
+static int sdcard_switch_high_speed(void)
+{
+    static u8 status[SD_SWITCH_STATUS_SIZE] ALIGNED(32);
+    struct sdmmc_command cmd;
+
+    for (int set = 0; set <= 1; set++) {
+        DPRINTF(2, ("sdcard: SD_SWITCH_FUNC(%s)\n", set ? "set" : "check"));
+        memset(&cmd, 0, sizeof(cmd));
+        cmd.c_opcode = SD_SWITCH_FUNC;
+        cmd.c_arg = SD_SWITCH_ACCESS_MODE_ARG(set ? SD_SWITCH_MODE_SET : SD_SWITCH_MODE_CHECK,
+                                              SD_ACCESS_MODE_SDR25);
+        cmd.c_data = status;
+        cmd.c_datalen = SD_SWITCH_STATUS_SIZE;
+        cmd.c_blklen = SD_SWITCH_STATUS_SIZE;
+        cmd.c_flags = SCF_RSP_R1 | SCF_CMD_READ;
+        sdhc_exec_command(card.handle, &cmd);
+
+        if (cmd.c_error) {
+            printf("sdcard: SD_SWITCH_FUNC failed with %d\n", cmd.c_error);
+            return -1;
+        }
+
+        if (!ISSET(SD_SWITCH_ACCESS_MODES(status), 1 << SD_ACCESS_MODE_SDR25) ||
+            SD_SWITCH_ACCESS_MODE(status) != SD_ACCESS_MODE_SDR25)
+            return -1;
+    }
+
+    return 0;
+}
+
 void sdcard_needs_discover(void)
 {
     struct sdmmc_command cmd;
@@ -190,6 +227,7 @@ void sdcard_needs_discover(void)
 
     resp = (u8 *)cmd.c_resp;
     resp32 = (u32 *)cmd.c_resp;
+    memcpy(card.cid, resp32, sizeof(card.cid));
     printf("CID: %08lX%08lX%08lX%08lX\n", resp32[0], resp32[1], resp32[2], resp32[3]);
     printf("CID: mid=%02x name='%c%c%c%c%c%c%c' prv=%d.%d psn=%02x%02x%02x%02x mdt=%d/%d\n", resp[14],
         resp[13],resp[12],resp[11],resp[10],resp[9],resp[8],resp[7], resp[6], resp[5] >> 4, resp[5] & 0xf,
@@ -226,6 +264,9 @@ void sdcard_needs_discover(void)
     resp32 = (u32 *)cmd.c_resp;
     printf("CSD: %08lX%08lX%08lX%08lX\n", resp32[0], resp32[1], resp32[2], resp32[3]);
 
+    int erase_supported = ISSET(SD_CSD_CCC(cmd.c_resp), SD_CSD_CCC_ERASE);
+    int switch_supported = ISSET(SD_CSD_CCC(cmd.c_resp), SD_CSD_CCC_SWITCH);
+
     if (resp[13] == 0xe) { // sdhc
         unsigned int c_size = resp[7] << 16 | resp[6] << 8 | resp[5];
         printf("sdcard: sdhc mode, c_size=%u, card size = %uk\n", c_size, (c_size + 1)* 512);
@@ -273,37 +314,91 @@ void sdcard_needs_discover(void)
         goto out_clock;
     }
 
+    // the SCR says which bus widths and spec version the card has
+    static u8 scr[SD_SCR_SIZE] ALIGNED(32);
+    int scr_valid = 0;
+
     DPRINTF(2, ("sdcard: MMC_APP_CMD\n"));
     memset(&cmd, 0, sizeof(cmd));
     cmd.c_opcode = MMC_APP_CMD;
     cmd.c_arg = ((u32)card.rca)<<16;
     cmd.c_flags = SCF_RSP_R1;
     sdhc_exec_command(card.handle, &cmd);
-    if (cmd.c_error) {
-        printf("sdcard: MMC_APP_CMD failed with %d\n", cmd.c_error);
-        card.inserted = card.selected = 0;
-        goto out_clock;
+
+    if (!cmd.c_error) {
+        DPRINTF(2, ("sdcard: SD_APP_SEND_SCR\n"));
+        memset(&cmd, 0, sizeof(cmd));
+        cmd.c_opcode = SD_APP_SEND_SCR;
+        cmd.c_data = scr;
+        cmd.c_datalen = SD_SCR_SIZE;
+        cmd.c_blklen = SD_SCR_SIZE;
+        cmd.c_flags = SCF_RSP_R1 | SCF_CMD_READ;
+        sdhc_exec_command(card.handle, &cmd);
     }
 
-    DPRINTF(2, ("sdcard: SD_APP_SET_BUS_WIDTH\n"));
-    memset(&cmd, 0, sizeof(cmd));
-    cmd.c_opcode = SD_APP_SET_BUS_WIDTH;
-    cmd.c_arg = SD_ARG_BUS_WIDTH_4;
-    cmd.c_flags = SCF_RSP_R1;
-    sdhc_exec_command(card.handle, &cmd);
-    if (cmd.c_error) {
-        printf("sdcard: SD_APP_SET_BUS_WIDTH failed with %d\n", cmd.c_error);
-        card.inserted = card.selected = 0;
-        goto out_clock;
+    // not fatal, we just won't use erases or high speed
+    if (cmd.c_error)
+        printf("sdcard: SD_APP_SEND_SCR failed with %d\n", cmd.c_error);
+    else
+        scr_valid = 1;
+
+    card.erased_value = -1;
+    if (erase_supported && scr_valid)
+        card.erased_value = SD_SCR_DATA_STAT_AFTER_ERASE(scr) ? 0xFF : 0x00;
+
+    // every SD memory card should do 4-bit, but go by the SCR if we have it
+    int bus_width = 4;
+    if (scr_valid && !ISSET(SD_SCR_BUS_WIDTHS(scr), SD_SCR_BUS_WIDTH_4))
+        bus_width = 1;
+
+    if (bus_width == 4) {
+        DPRINTF(2, ("sdcard: MMC_APP_CMD\n"));
+        memset(&cmd, 0, sizeof(cmd));
+        cmd.c_opcode = MMC_APP_CMD;
+        cmd.c_arg = ((u32)card.rca)<<16;
+        cmd.c_flags = SCF_RSP_R1;
+        sdhc_exec_command(card.handle, &cmd);
+        if (cmd.c_error) {
+            printf("sdcard: MMC_APP_CMD failed with %d\n", cmd.c_error);
+            card.inserted = card.selected = 0;
+            goto out_clock;
+        }
+
+        DPRINTF(2, ("sdcard: SD_APP_SET_BUS_WIDTH\n"));
+        memset(&cmd, 0, sizeof(cmd));
+        cmd.c_opcode = SD_APP_SET_BUS_WIDTH;
+        cmd.c_arg = SD_ARG_BUS_WIDTH_4;
+        cmd.c_flags = SCF_RSP_R1;
+        sdhc_exec_command(card.handle, &cmd);
+        if (cmd.c_error) {
+            printf("sdcard: SD_APP_SET_BUS_WIDTH failed with %d\n", cmd.c_error);
+            card.inserted = card.selected = 0;
+            goto out_clock;
+        }
+
+        sdhc_bus_width(card.handle, 4);
     }
 
-    sdhc_bus_width(card.handle, 4);
+    // CMD6 came with SD 1.10, and the card has to list class 10 (switch)
+    int high_speed = 0;
+    if (switch_supported && scr_valid && SD_SCR_SD_SPEC(scr) >= SD_SCR_SD_SPEC_1_10 &&
+        sdhc_bus_high_speed(card.handle))
+        high_speed = sdcard_switch_high_speed() == 0;
 
     DPRINTF(1, ("sdcard: enabling clock\n"));
-    if (sdhc_bus_clock(card.handle, SDMMC_SDCLK_25MHZ, SDMMC_TIMING_LEGACY) != 0) {
-        printf("sdcard: could not enable clock for card\n");
-        goto out_power;
+    if (high_speed) {
+        if (sdhc_bus_clock(card.handle, SDMMC_SDCLK_50MHZ, SDMMC_TIMING_HIGHSPEED) != 0) {
+            printf("sdcard: could not enable clock for card\n");
+            goto out_power;
+        }
+    } else {
+        if (sdhc_bus_clock(card.handle, SDMMC_SDCLK_25MHZ, SDMMC_TIMING_LEGACY) != 0) {
+            printf("sdcard: could not enable clock for card\n");
+            goto out_power;
+        }
     }
+
+    printf("sdcard: %d-bit bus, %s\n", bus_width, high_speed ? "high speed (50 MHz)" : "default speed (25 MHz)");
     return;
 
 out_clock:
@@ -398,7 +493,7 @@ int sdcard_start_read(u32 blk_start, u32 blk_count, void *data, struct sdmmc_com
     cmdbuf->c_datalen = blk_count * SDMMC_DEFAULT_BLOCKLEN;
     cmdbuf->c_blklen = SDMMC_DEFAULT_BLOCKLEN;
     cmdbuf->c_flags = SCF_RSP_R1 | SCF_CMD_READ;
-    sdhc_async_command(card.handle, cmdbuf);
+    sdhc_queue_command(card.handle, cmdbuf);
 
     if (cmdbuf->c_error) {
         printf("sdcard: MMC_READ_BLOCK_%s failed with %d\n", blk_count > 1 ? "MULTIPLE" : "SINGLE", cmdbuf->c_error);
@@ -432,7 +527,7 @@ int sdcard_end_read(struct sdmmc_command* cmdbuf)
         return -1;
     }
 
-    sdhc_async_response(card.handle, cmdbuf);
+    sdhc_wait_command(card.handle, cmdbuf);
 
     if (cmdbuf->c_error) {
         printf("sdcard: MMC_READ_BLOCK_%s failed with %d\n", cmdbuf->c_opcode == MMC_READ_BLOCK_MULTIPLE ? "MULTIPLE" : "SINGLE", cmdbuf->c_error);
@@ -499,6 +594,41 @@ int sdcard_read(u32 blk_start, u32 blk_count, void *data)
     return 0;
 }
 
+int sdcard_open_stream(u32 blk_start, int write, struct sdhc_stream* stream)
+{
+    if (card.inserted == 0) {
+        printf("sdcard: STREAM: no card inserted.\n");
+        return -1;
+    }
+
+    if (card.selected == 0) {
+        if (sdcard_select() < 0) {
+            printf("sdcard: STREAM: cannot select card.\n");
+            return -1;
+        }
+    }
+
+    if (card.new_card == 1) {
+        printf("sdcard: new card inserted but not acknowledged yet.\n");
+        return -1;
+    }
+
+    memset(&stream->cmd, 0, sizeof(struct sdmmc_command));
+
+    stream->cmd.c_opcode = write ? MMC_WRITE_BLOCK_MULTIPLE : MMC_READ_BLOCK_MULTIPLE;
+    if (card.sdhc_blockmode)
+        stream->cmd.c_arg = blk_start;
+    else
+        stream->cmd.c_arg = blk_start * SDMMC_DEFAULT_BLOCKLEN;
+    stream->cmd.c_blklen = SDMMC_DEFAULT_BLOCKLEN;
+    stream->cmd.c_flags = write ? SCF_RSP_R1 : SCF_RSP_R1 | SCF_CMD_READ;
+    sdhc_stream_open(card.handle, stream);
+
+    DPRINTF(2, ("sdcard: stream %s opened at %u\n", write ? "WRITE" : "READ", blk_start));
+
+    return 0;
+}
+
 #ifndef LOADER
 int sdcard_start_write(u32 blk_start, u32 blk_count, void *data, struct sdmmc_command* cmdbuf)
 {
@@ -536,7 +666,7 @@ int sdcard_start_write(u32 blk_start, u32 blk_count, void *data, struct sdmmc_co
     cmdbuf->c_datalen = blk_count * SDMMC_DEFAULT_BLOCKLEN;
     cmdbuf->c_blklen = SDMMC_DEFAULT_BLOCKLEN;
     cmdbuf->c_flags = SCF_RSP_R1;
-    sdhc_async_command(card.handle, cmdbuf);
+    sdhc_queue_command(card.handle, cmdbuf);
 
     if (cmdbuf->c_error) {
         printf("sdcard: MMC_WRITE_BLOCK_%s failed with %d\n", blk_count > 1 ? "MULTIPLE" : "SINGLE", cmdbuf->c_error);
@@ -569,7 +699,7 @@ int sdcard_end_write(struct sdmmc_command* cmdbuf)
         return -1;
     }
 
-    sdhc_async_response(card.handle, cmdbuf);
+    sdhc_wait_command(card.handle, cmdbuf);
 
     if (cmdbuf->c_error) {
         printf("sdcard: MMC_WRITE_BLOCK_%s failed with %d\n", cmdbuf->c_opcode == MMC_WRITE_BLOCK_MULTIPLE ? "MULTIPLE" : "SINGLE", cmdbuf->c_error);
@@ -635,6 +765,90 @@ int sdcard_write(u32 blk_start, u32 blk_count, void *data)
     return 0;
 }
 
+int sdcard_erase(u32 blk_start, u32 blk_count)
+{
+    struct sdmmc_command cmd;
+
+    if (card.inserted == 0) {
+        printf("sdcard: ERASE: no card inserted.\n");
+        return -1;
+    }
+
+    if (card.selected == 0) {
+        if (sdcard_select() < 0) {
+            printf("sdcard: ERASE: cannot select card.\n");
+            return -1;
+        }
+    }
+
+    if (card.new_card == 1) {
+        printf("sdcard: new card inserted but not acknowledged yet.\n");
+        return -1;
+    }
+
+    if (card.erased_value < 0 || blk_count == 0)
+        return -1;
+
+    u32 first = blk_start, last = blk_start + blk_count - 1;
+    if (!card.sdhc_blockmode) {
+        first *= SDMMC_DEFAULT_BLOCKLEN;
+        last *= SDMMC_DEFAULT_BLOCKLEN;
+    }
+
+    DPRINTF(2, ("sdcard: SD_ERASE_WR_BLK_START\n"));
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.c_opcode = SD_ERASE_WR_BLK_START;
+    cmd.c_arg = first;
+    cmd.c_flags = SCF_RSP_R1;
+    sdhc_exec_command(card.handle, &cmd);
+    if (cmd.c_error) {
+        printf("sdcard: SD_ERASE_WR_BLK_START failed with %d\n", cmd.c_error);
+        return -1;
+    }
+
+    DPRINTF(2, ("sdcard: SD_ERASE_WR_BLK_END\n"));
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.c_opcode = SD_ERASE_WR_BLK_END;
+    cmd.c_arg = last;
+    cmd.c_flags = SCF_RSP_R1;
+    sdhc_exec_command(card.handle, &cmd);
+    if (cmd.c_error) {
+        printf("sdcard: SD_ERASE_WR_BLK_END failed with %d\n", cmd.c_error);
+        return -1;
+    }
+
+    DPRINTF(2, ("sdcard: MMC_ERASE\n"));
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.c_opcode = MMC_ERASE;
+    cmd.c_arg = 0;
+    cmd.c_flags = SCF_RSP_R1B;
+    sdhc_exec_command(card.handle, &cmd);
+    if (cmd.c_error) {
+        printf("sdcard: MMC_ERASE failed with %d\n", cmd.c_error);
+        return -1;
+    }
+
+    // the card stays busy until the erase is done
+    return sdcard_wait_data();
+}
+
+int sdcard_erased_value(void)
+{
+    if (card.inserted == 0 || card.new_card == 1)
+        return -1;
+
+    return card.erased_value;
+}
+
+int sdcard_get_cid(u32 *cid)
+{
+    if (card.inserted == 0 || card.new_card == 1)
+        return -1;
+
+    memcpy(cid, card.cid, sizeof(card.cid));
+    return 0;
+}
+
 int sdcard_wait_data(void)
 {
     struct sdmmc_command cmd;
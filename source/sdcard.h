@@ -16,6 +16,8 @@
 #include "bsdtypes.h"
 #include "sdmmc.h"
 
+struct sdhc_stream;
+
 void sdcard_init(void);
 void sdcard_exit(void);
 void sdcard_irq(void);
@@ -38,4 +40,12 @@ int sdcard_end_read(struct sdmmc_command* cmdbuf);
 int sdcard_start_write(u32 blk_start, u32 blk_count, void *data, struct sdmmc_command* cmdbuf);
 int sdcard_end_write(struct sdmmc_command* cmdbuf);
 
+// Opens an open-ended read or write on the card's host, see sdhc_stream_open().
+int sdcard_open_stream(u32 blk_start, int write, struct sdhc_stream* stream);
+
+int sdcard_erase(u32 blk_start, u32 blk_count);
+int sdcard_erased_value(void);
+
+int sdcard_get_cid(u32 *cid);
+
 #endif
@@ -94,6 +94,8 @@ static inline void bus_space_write_1(bus_space_handle_t ioh, u32 r, u8 v)
 
 /* flag values */
 #define SHF_USE_DMA     0x0001
+#define SHF_HIGH_SPEED  0x0002
+#define SHF_8BIT_BUS    0x0004
 
 #define HREAD1(hp, reg)                         \
     (bus_space_read_1((hp)->ioh, (reg)))
@@ -183,6 +185,14 @@ sdhc_host_found(struct sdhc_host *hp, struct sdhc_host_params *pa, bus_space_tag
     if (usedma && ISSET(caps, SDHC_DMA_SUPPORT))
         SET(hp->flags, SHF_USE_DMA);
 
+    /* High speed timing lets the bus run at up to 50 MHz. */
+    if (ISSET(caps, SDHC_HIGH_SPEED_SUPP))
+        SET(hp->flags, SHF_HIGH_SPEED);
+
+    /* Only embedded devices can have eight data lines. */
+    if (ISSET(caps, SDHC_8BIT_SUPP))
+        SET(hp->flags, SHF_8BIT_BUS);
+
     /*
      * Determine the base clock frequency. (2.2.24)
      */
@@ -370,6 +380,24 @@ sdhc_clock_divisor(struct sdhc_host *hp, u_int freq)
     return -1;
 }
 
+/*
+ * Return non-zero if the controller can do high speed timing.
+ */
+int
+sdhc_bus_high_speed(struct sdhc_host *hp)
+{
+    return ISSET(hp->flags, SHF_HIGH_SPEED);
+}
+
+/*
+ * Return the widest data bus the controller has.
+ */
+int
+sdhc_bus_width_max(struct sdhc_host *hp)
+{
+    return ISSET(hp->flags, SHF_8BIT_BUS) ? 8 : 4;
+}
+
 /*
  * Set or change SDCLK frequency or disable the SD clock.
  * Return zero on success.
@@ -490,6 +518,11 @@ sdhc_async_command(struct sdhc_host *hp, struct sdmmc_command *cmd)
 {
     int error;
 
+    /* queued commands own the controller until they're done, streams until closed */
+    if (hp->stream != NULL)
+        sdhc_stream_close(hp->stream);
+    sdhc_wait_queue(hp);
+
     if (cmd->c_datalen > 0)
         hp->data_command = 1;
 
@@ -514,6 +547,27 @@ sdhc_async_command(struct sdhc_host *hp, struct sdmmc_command *cmd)
     }
 }
 
+/*
+ * The host controller removes bits [0:7] from the response
+ * data (CRC) and we pass the data up unchanged to the bus
+ * driver (without padding).
+ */
+static void
+sdhc_read_response(struct sdhc_host *hp, struct sdmmc_command *cmd)
+{
+    if (!ISSET(cmd->c_flags, SCF_RSP_PRESENT))
+        return;
+
+    if (ISSET(cmd->c_flags, SCF_RSP_136)) {
+        u_char *p = (u_char *)cmd->c_resp;
+        int i;
+
+        for (i = 0; i < 15; i++)
+            *p++ = HREAD1(hp, SDHC_RESPONSE + i);
+    } else
+        cmd->c_resp[0] = HREAD4(hp, SDHC_RESPONSE);
+}
+
 void
 sdhc_async_response(struct sdhc_host *hp, struct sdmmc_command *cmd)
 {
@@ -534,21 +588,8 @@ sdhc_async_response(struct sdhc_host *hp, struct sdmmc_command *cmd)
 
 //  printf("command_complete, continuing...\n");
 
-    /*
-     * The host controller removes bits [0:7] from the response
-     * data (CRC) and we pass the data up unchanged to the bus
-     * driver (without padding).
-     */
-    if (cmd->c_error == 0 && ISSET(cmd->c_flags, SCF_RSP_PRESENT)) {
-        if (ISSET(cmd->c_flags, SCF_RSP_136)) {
-            u_char *p = (u_char *)cmd->c_resp;
-            int i;
-
-            for (i = 0; i < 15; i++)
-                *p++ = HREAD1(hp, SDHC_RESPONSE + i);
-        } else
-            cmd->c_resp[0] = HREAD4(hp, SDHC_RESPONSE);
-    }
+    if (cmd->c_error == 0)
+        sdhc_read_response(hp, cmd);
 
     /*
      * If the command has data to transfer in any direction,
@@ -570,6 +611,360 @@ sdhc_exec_command(struct sdhc_host *hp, struct sdmmc_command *cmd)
     sdhc_async_response(hp, cmd);
 }
 
+/* Completes the running queued command. */
+static void
+sdhc_queue_complete(struct sdhc_host *hp, int error)
+{
+    struct sdmmc_command *cmd = hp->queue[hp->queue_head % SDHC_QUEUE_DEPTH];
+
+    if (error != 0)
+        cmd->c_error = error;
+    if (ISSET(cmd->c_flags, SCF_CMD_READ) && cmd->c_datalen > 0)
+        ahb_flush_from(hp->pa.wb);
+
+    DPRINTF(1,("sdhc: queued cmd %u done (error=%d)\n", cmd->c_opcode, cmd->c_error));
+
+    hp->data_command = 0;
+    hp->queue_head++;
+    SET(cmd->c_flags, SCF_ITSDONE);
+    if (cmd->c_done)
+        cmd->c_done(cmd, cmd->c_done_arg);
+}
+
+/* Starts the next queued command, if any. */
+static void
+sdhc_queue_start(struct sdhc_host *hp)
+{
+    while (hp->queue_head != hp->queue_tail) {
+        struct sdmmc_command *cmd = hp->queue[hp->queue_head % SDHC_QUEUE_DEPTH];
+
+        hp->data_command = cmd->c_datalen > 0;
+        hp->queue_state = SDHC_QUEUE_COMMAND;
+
+        int error = sdhc_start_command(hp, cmd);
+        if (error == 0)
+            return;
+
+        sdhc_queue_complete(hp, error);
+    }
+
+    hp->queue_state = SDHC_QUEUE_IDLE;
+}
+
+/* Moves the running queued command along, from sdhc_intr(). */
+static void
+sdhc_queue_intr(struct sdhc_host *hp, u_int16_t status)
+{
+    struct sdmmc_command *cmd = hp->queue[hp->queue_head % SDHC_QUEUE_DEPTH];
+
+    if (hp->queue_state == SDHC_QUEUE_COMMAND && ISSET(status, SDHC_COMMAND_COMPLETE)) {
+        sdhc_read_response(hp, cmd);
+        hp->queue_state = cmd->c_datalen > 0 ? SDHC_QUEUE_DATA : SDHC_QUEUE_IDLE;
+    }
+
+    if (hp->queue_state == SDHC_QUEUE_DATA && ISSET(status, SDHC_TRANSFER_COMPLETE))
+        hp->queue_state = SDHC_QUEUE_IDLE;
+
+    if (hp->queue_state == SDHC_QUEUE_IDLE) {
+        sdhc_queue_complete(hp, 0);
+        sdhc_queue_start(hp);
+    }
+}
+
+int
+sdhc_queue_command(struct sdhc_host *hp, struct sdmmc_command *cmd)
+{
+    if (cmd->c_timeout == 0) {
+        if (cmd->c_datalen > 0)
+            cmd->c_timeout = SDHC_TRANSFER_TIMEOUT;
+        else
+            cmd->c_timeout = SDHC_COMMAND_TIMEOUT;
+    }
+    cmd->c_error = 0;
+    cmd->c_flags &= ~SCF_ITSDONE;
+
+    if (hp->stream != NULL)
+        sdhc_stream_close(hp->stream);
+
+#ifdef CAN_HAZ_IRQ
+    u32 cookie = irq_kill();
+#endif
+    int error = 0;
+    if (hp->queue_tail - hp->queue_head >= SDHC_QUEUE_DEPTH) {
+        error = EBUSY;
+        cmd->c_error = error;
+        SET(cmd->c_flags, SCF_ITSDONE);
+    } else {
+        hp->queue[hp->queue_tail++ % SDHC_QUEUE_DEPTH] = cmd;
+        if (hp->queue_state == SDHC_QUEUE_IDLE)
+            sdhc_queue_start(hp);
+    }
+#ifdef CAN_HAZ_IRQ
+    irq_restore(cookie);
+#endif
+
+    return error;
+}
+
+int
+sdhc_wait_command(struct sdhc_host *hp, struct sdmmc_command *cmd)
+{
+    while (!ISSET(cmd->c_flags, SCF_ITSDONE)) {
+#ifdef CAN_HAZ_IRQ
+        u32 cookie = irq_kill();
+        if (!ISSET(cmd->c_flags, SCF_ITSDONE))
+            irq_wait();
+        irq_restore(cookie);
+#else
+        sdhc_intr(hp);
+#endif
+    }
+
+    return cmd->c_error;
+}
+
+void
+sdhc_wait_queue(struct sdhc_host *hp)
+{
+    while (hp->queue_state != SDHC_QUEUE_IDLE) {
+#ifdef CAN_HAZ_IRQ
+        u32 cookie = irq_kill();
+        if (hp->queue_state != SDHC_QUEUE_IDLE)
+            irq_wait();
+        irq_restore(cookie);
+#else
+        sdhc_intr(hp);
+#endif
+    }
+}
+
+/* Points the DMA at the stream's head segment. */
+static void
+sdhc_stream_next(struct sdhc_host *hp, struct sdhc_stream *st)
+{
+    u_int i = st->head % SDHC_STREAM_SEGMENTS;
+
+    st->left = st->seg_len[i];
+    st->state = SDHC_STREAM_RUNNING;
+    HWRITE4(hp, SDHC_DMA_ADDR, (u32)st->seg[i]);
+}
+
+/* Moves the open stream along, from sdhc_intr(). */
+static void
+sdhc_stream_intr(struct sdhc_host *hp, struct sdhc_stream *st, u_int16_t status)
+{
+    if (ISSET(status, SDHC_COMMAND_COMPLETE))
+        sdhc_read_response(hp, &st->cmd);
+
+    if (ISSET(status, SDHC_DMA_INTERRUPT) && st->state == SDHC_STREAM_RUNNING) {
+        st->left -= SDHC_STREAM_BOUNDARY;
+        if (st->left > 0) {
+            /* same as for a normal command, see sdhc_intr() */
+            HWRITE4(hp, SDHC_DMA_ADDR, HREAD4(hp, SDHC_DMA_ADDR));
+        } else {
+            if (ISSET(st->cmd.c_flags, SCF_CMD_READ))
+                ahb_flush_from(hp->pa.wb);
+
+            st->head++;
+            if (st->head != st->tail)
+                sdhc_stream_next(hp, st);
+            else
+                st->state = SDHC_STREAM_STALLED;
+        }
+    }
+
+    /* only ever happens once we asked it to stop at a block gap */
+    if (ISSET(status, SDHC_TRANSFER_COMPLETE) && st->state == SDHC_STREAM_STOPPING)
+        st->state = SDHC_STREAM_STOPPED;
+}
+
+/* Ends the open stream on an error interrupt, from sdhc_intr(). */
+static void
+sdhc_stream_fail(struct sdhc_stream *st, int error)
+{
+    /*
+     * A read that ran out of segments only timed out waiting for more, and
+     * nothing was lost. A write can still have had blocks of its last segment
+     * in the host's buffer, which the reset after the error dropped, so it
+     * has to fail for that segment to be written again.
+     */
+    if (st->state != SDHC_STREAM_STALLED || !ISSET(st->cmd.c_flags, SCF_CMD_READ))
+        st->error = error;
+    st->state = SDHC_STREAM_CLOSED;
+}
+
+int
+sdhc_stream_open(struct sdhc_host *hp, struct sdhc_stream *st)
+{
+    if (hp->stream != NULL)
+        sdhc_stream_close(hp->stream);
+    sdhc_wait_queue(hp);
+
+    st->hp = hp;
+    st->head = st->tail = st->left = 0;
+    st->error = 0;
+    st->state = SDHC_STREAM_OPEN;
+    st->cmd.c_error = 0;
+    SET(st->cmd.c_flags, SCF_STREAM);
+
+    hp->stream = st;
+    return 0;
+}
+
+int
+sdhc_stream_push(struct sdhc_stream *st, void *data, u_int len)
+{
+    struct sdhc_host *hp = st->hp;
+    int error = 0;
+
+    if (len == 0 || len % SDHC_STREAM_BOUNDARY || (u32)data % SDHC_STREAM_BOUNDARY)
+        return EINVAL;
+
+    if (ISSET(st->cmd.c_flags, SCF_CMD_READ)) {
+        dc_invalidaterange(data, len);
+    } else {
+        dc_flushrange(data, len);
+        ahb_flush_to(hp->pa.rb);
+    }
+
+#ifdef CAN_HAZ_IRQ
+    u32 cookie = irq_kill();
+#endif
+    if (st->state == SDHC_STREAM_CLOSED) {
+        error = st->error ? st->error : EPIPE;
+    } else if (st->tail - st->head >= SDHC_STREAM_SEGMENTS) {
+        error = EBUSY;
+    } else {
+        st->seg[st->tail % SDHC_STREAM_SEGMENTS] = data;
+        st->seg_len[st->tail % SDHC_STREAM_SEGMENTS] = len;
+        st->tail++;
+
+        if (st->state == SDHC_STREAM_OPEN) {
+            st->cmd.c_data = data;
+            st->cmd.c_datalen = len;
+            st->left = len;
+            st->state = SDHC_STREAM_RUNNING;
+            hp->data_command = 1;
+
+            error = sdhc_start_command(hp, &st->cmd);
+            if (error != 0) {
+                st->error = error;
+                st->state = SDHC_STREAM_CLOSED;
+                hp->data_command = 0;
+                hp->stream = NULL;
+            }
+        } else if (st->state == SDHC_STREAM_STALLED)
+            sdhc_stream_next(hp, st);
+    }
+#ifdef CAN_HAZ_IRQ
+    irq_restore(cookie);
+#endif
+
+    return error;
+}
+
+int
+sdhc_stream_wait(struct sdhc_stream *st, u_int count)
+{
+    while ((int)(count - st->head) > 0 && st->state != SDHC_STREAM_CLOSED) {
+#ifdef CAN_HAZ_IRQ
+        u32 cookie = irq_kill();
+        if ((int)(count - st->head) > 0 && st->state != SDHC_STREAM_CLOSED)
+            irq_wait();
+        irq_restore(cookie);
+#else
+        sdhc_intr(st->hp);
+#endif
+    }
+
+    if ((int)(count - st->head) > 0)
+        return st->error ? st->error : EPIPE;
+    return 0;
+}
+
+int
+sdhc_stream_close(struct sdhc_stream *st)
+{
+    struct sdhc_host *hp = st->hp;
+    struct sdmmc_command stop;
+    int write = !ISSET(st->cmd.c_flags, SCF_CMD_READ);
+    int error;
+
+    if (st->state == SDHC_STREAM_OPEN) {
+        st->state = SDHC_STREAM_CLOSED;
+        hp->stream = NULL;
+    }
+    if (st->state == SDHC_STREAM_CLOSED)
+        return st->error;
+
+    /* everything pushed goes through first; this only fails once closed */
+    if ((error = sdhc_stream_wait(st, st->tail)) != 0) {
+        st->error = error;
+        return error;
+    }
+
+    /*
+     * Writes still have data in the buffer once the DMA stops, so they
+     * stop at the next block gap. Reads have nothing we want left.
+     */
+    if (write) {
+#ifdef CAN_HAZ_IRQ
+        u32 cookie = irq_kill();
+#endif
+        if (st->state == SDHC_STREAM_STALLED) {
+            st->state = SDHC_STREAM_STOPPING;
+            HSET1(hp, SDHC_BLOCK_GAP_CTL, SDHC_STOP_AT_BLOCK_GAP);
+        }
+#ifdef CAN_HAZ_IRQ
+        irq_restore(cookie);
+#endif
+
+        while (st->state == SDHC_STREAM_STOPPING) {
+#ifdef CAN_HAZ_IRQ
+            cookie = irq_kill();
+            if (st->state == SDHC_STREAM_STOPPING)
+                irq_wait();
+            irq_restore(cookie);
+#else
+            sdhc_intr(hp);
+#endif
+        }
+    }
+
+    if (st->state == SDHC_STREAM_CLOSED) {
+        HCLR1(hp, SDHC_BLOCK_GAP_CTL, SDHC_STOP_AT_BLOCK_GAP);
+        return st->error;
+    }
+
+    hp->stream = NULL;
+    st->state = SDHC_STREAM_CLOSED;
+
+    memset(&stop, 0, sizeof(stop));
+    stop.c_opcode = MMC_STOP_TRANSMISSION;
+    stop.c_flags = SCF_RSP_R1B;
+    sdhc_exec_command(hp, &stop);
+    error = stop.c_error;
+
+    /* let the card finish programming, it holds DAT0 low until then */
+    if (write) {
+        int timo;
+        for (timo = SDHC_TRANSFER_TIMEOUT * 10; timo > 0; timo--) {
+            if (ISSET(HREAD4(hp, SDHC_PRESENT_STATE), SDHC_DAT0_LINE_LEVEL))
+                break;
+            udelay(100);
+        }
+        if (timo == 0 && error == 0)
+            error = ETIMEDOUT;
+    }
+
+    (void)sdhc_soft_reset(hp, SDHC_RESET_DAT|SDHC_RESET_CMD);
+    HCLR1(hp, SDHC_BLOCK_GAP_CTL, SDHC_STOP_AT_BLOCK_GAP);
+    hp->data_command = 0;
+
+    st->error = error;
+    return error;
+}
+
 int
 sdhc_start_command(struct sdhc_host *hp, struct sdmmc_command *cmd)
 {
@@ -577,6 +972,7 @@ sdhc_start_command(struct sdhc_host *hp, struct sdmmc_command *cmd)
     u_int16_t blkcount = 0;
     u_int16_t mode;
     u_int16_t command;
+    u_int16_t boundary = SDHC_DMA_BOUNDARY_512K;
     int error;
 
     DPRINTF(1,("sdhc: start cmd %u arg=%#x data=%p dlen=%d flags=%#x\n",
@@ -588,7 +984,11 @@ sdhc_start_command(struct sdhc_host *hp, struct sdmmc_command *cmd)
      */
 
     /* Fragment the data into proper blocks. */
-    if (cmd->c_datalen > 0) {
+    if (ISSET(cmd->c_flags, SCF_STREAM)) {
+        /* no block count, runs until sdhc_stream_close() */
+        blksize = cmd->c_blklen;
+        boundary = SDHC_DMA_BOUNDARY_32K;   /* SDHC_STREAM_BOUNDARY */
+    } else if (cmd->c_datalen > 0) {
         blksize = MIN(cmd->c_datalen, cmd->c_blklen);
         blkcount = cmd->c_datalen / blksize;
         if (cmd->c_datalen % blksize > 0) {
@@ -608,7 +1008,9 @@ sdhc_start_command(struct sdhc_host *hp, struct sdmmc_command *cmd)
     mode = 0;
     if (ISSET(cmd->c_flags, SCF_CMD_READ))
         mode |= SDHC_READ_MODE;
-    if (blkcount > 0) {
+    if (ISSET(cmd->c_flags, SCF_STREAM))
+        mode |= SDHC_MULTI_BLOCK_MODE;
+    else if (blkcount > 0) {
         mode |= SDHC_BLOCK_COUNT_ENABLE;
         if (blkcount > 1) {
             mode |= SDHC_MULTI_BLOCK_MODE;
@@ -625,6 +1027,10 @@ sdhc_start_command(struct sdhc_host *hp, struct sdmmc_command *cmd)
     command = (cmd->c_opcode & SDHC_COMMAND_INDEX_MASK) <<
         SDHC_COMMAND_INDEX_SHIFT;
 
+    /* CMD12 may go out while the data lines are still busy. */
+    if (cmd->c_opcode == MMC_STOP_TRANSMISSION)
+        command |= SDHC_COMMAND_TYPE_ABORT;
+
     if (ISSET(cmd->c_flags, SCF_RSP_CRC))
         command |= SDHC_CRC_CHECK_ENABLE;
     if (ISSET(cmd->c_flags, SCF_RSP_IDX))
@@ -642,7 +1048,8 @@ sdhc_start_command(struct sdhc_host *hp, struct sdmmc_command *cmd)
         command |= SDHC_RESP_LEN_48;
 
     /* Wait until command and data inhibit bits are clear. (1.5) */
-    if ((error = sdhc_wait_state(hp, SDHC_CMD_INHIBIT_MASK, 0)) != 0)
+    if ((error = sdhc_wait_state(hp, cmd->c_opcode == MMC_STOP_TRANSMISSION ?
+        SDHC_CMD_INHIBIT_CMD : SDHC_CMD_INHIBIT_MASK, 0)) != 0)
         return error;
 
     if (ISSET(hp->flags, SHF_USE_DMA) && cmd->c_datalen > 0) {
@@ -666,7 +1073,7 @@ sdhc_start_command(struct sdhc_host *hp, struct sdmmc_command *cmd)
      * of the SDHC_COMMAND register triggers the SD command. (1.5)
      */
 //  HWRITE2(hp, SDHC_TRANSFER_MODE, mode);
-    HWRITE2(hp, SDHC_BLOCK_SIZE, blksize | 7 << 12);
+    HWRITE2(hp, SDHC_BLOCK_SIZE, blksize | boundary << SDHC_DMA_BOUNDARY_SHIFT);
     HWRITE2(hp, SDHC_BLOCK_COUNT, blkcount);
     HWRITE4(hp, SDHC_ARGUMENT, cmd->c_arg);
 //  http://wiibrew.org/wiki/Reversed_Little_Endian
@@ -831,8 +1238,15 @@ sdhc_intr(struct sdhc_host *hp)
     HWRITE2(hp, SDHC_NINTR_STATUS, status);
     DPRINTF(2,("sdhc: interrupt status=%d\n", status));
 
+    int queued = hp->queue_state != SDHC_QUEUE_IDLE;
+    struct sdhc_stream *stream = hp->stream;
+
     /* Service error interrupts. */
     if (ISSET(status, SDHC_ERROR_INTERRUPT)) {
+        /* the abort below is synchronous, so it mustn't look queued or streaming */
+        hp->queue_state = SDHC_QUEUE_IDLE;
+        hp->stream = NULL;
+
         /* Acknowledge error interrupts. */
         HWRITE2(hp, SDHC_EINTR_SIGNAL_EN, 0);
         (void)sdhc_soft_reset(hp, SDHC_RESET_DAT|SDHC_RESET_CMD);
@@ -848,7 +1262,25 @@ sdhc_intr(struct sdhc_host *hp)
         if (ISSET(error, SDHC_CMD_TIMEOUT_ERROR|
             SDHC_DATA_TIMEOUT_ERROR)) {
             hp->intr_error_status |= error;
-            hp->intr_status |= status;
+            if (!queued && stream == NULL)
+                hp->intr_status |= status;
+        }
+
+        if (queued) {
+            sdhc_queue_complete(hp, ISSET(error, SDHC_CMD_TIMEOUT_ERROR|
+                SDHC_DATA_TIMEOUT_ERROR) ? ETIMEDOUT : EIO);
+            sdhc_queue_start(hp);
+            /* the rest of the status was about the failed command */
+            status &= ~(SDHC_COMMAND_COMPLETE|SDHC_TRANSFER_COMPLETE);
+            queued = 0;
+        }
+
+        if (stream != NULL) {
+            sdhc_stream_fail(stream, ISSET(error, SDHC_CMD_TIMEOUT_ERROR|
+                SDHC_DATA_TIMEOUT_ERROR) ? ETIMEDOUT : EIO);
+            HCLR1(hp, SDHC_BLOCK_GAP_CTL, SDHC_STOP_AT_BLOCK_GAP);
+            status &= ~(SDHC_COMMAND_COMPLETE|SDHC_TRANSFER_COMPLETE|SDHC_DMA_INTERRUPT);
+            stream = NULL;
         }
     }
 
@@ -859,10 +1291,15 @@ sdhc_intr(struct sdhc_host *hp)
     if (ISSET(status, SDHC_BUFFER_READ_READY|
         SDHC_BUFFER_WRITE_READY|SDHC_COMMAND_COMPLETE|
          SDHC_TRANSFER_COMPLETE)) {
-        hp->intr_status |= status;
+        if (queued)
+            sdhc_queue_intr(hp, status);
+        else if (stream == NULL)
+            hp->intr_status |= status;
     }
 
-    if (ISSET(status, SDHC_DMA_INTERRUPT)) {
+    if (stream != NULL)
+        sdhc_stream_intr(hp, stream, status);
+    else if (ISSET(status, SDHC_DMA_INTERRUPT)) {
         DPRINTF(2,("sdhc: dma left:%#x\n", HREAD2(hp, SDHC_BLOCK_COUNT)));
         // this works because our virtual memory
         // addresses are equal to the physical memory
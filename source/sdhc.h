@@ -25,6 +25,29 @@
 #include "sdmmc.h"
 #include "memory.h"
 
+#define SDHC_QUEUE_DEPTH    8
+
+enum {
+    SDHC_QUEUE_IDLE,
+    SDHC_QUEUE_COMMAND,
+    SDHC_QUEUE_DATA,
+};
+
+#define SDHC_STREAM_SEGMENTS    8
+/* SDMA boundary streams run with, see struct sdhc_stream */
+#define SDHC_STREAM_BOUNDARY    (32 * 1024)
+
+enum {
+    SDHC_STREAM_CLOSED,
+    SDHC_STREAM_OPEN,       /* waiting for its first segment */
+    SDHC_STREAM_RUNNING,
+    SDHC_STREAM_STALLED,    /* DMA stopped at a boundary, out of segments */
+    SDHC_STREAM_STOPPING,   /* asked to stop at the next block gap */
+    SDHC_STREAM_STOPPED,    /* stopped there, being closed */
+};
+
+struct sdhc_stream;
+
 struct sdhc_host_params {
     void (*attach)();
     void (*abort)();
@@ -44,6 +67,15 @@ struct sdhc_host {
     volatile u_int16_t intr_error_status;    /* soft error status */
     int data_command;
 
+    /* commands queued by sdhc_queue_command(), run from sdhc_intr() */
+    struct sdmmc_command *queue[SDHC_QUEUE_DEPTH];
+    volatile u_int queue_head;      /* running, or next to run */
+    volatile u_int queue_tail;      /* next free slot */
+    volatile int queue_state;       /* what the running one waits for */
+
+    /* open-ended transfer in progress, see sdhc_stream_open() */
+    struct sdhc_stream *volatile stream;
+
     struct sdhc_host_params pa;
 };
 
@@ -56,6 +88,9 @@ int sdhc_intr(struct sdhc_host *);
 /* Host standard register set */
 #define SDHC_DMA_ADDR           0x00
 #define SDHC_BLOCK_SIZE         0x04
+#define SDHC_DMA_BOUNDARY_SHIFT     12
+#define SDHC_DMA_BOUNDARY_32K       3
+#define SDHC_DMA_BOUNDARY_512K      7
 #define SDHC_BLOCK_COUNT        0x06
 #define SDHC_BLOCK_COUNT_MAX        512
 #define SDHC_ARGUMENT           0x08
@@ -117,6 +152,7 @@ int sdhc_intr(struct sdhc_host *);
 #define SDHC_VOLTAGE_1_8V       0x05
 #define SDHC_BUS_POWER          (1<<0)
 #define SDHC_BLOCK_GAP_CTL      0x2a
+#define SDHC_STOP_AT_BLOCK_GAP      (1<<0)
 #define SDHC_WAKEUP_CTL         0x2b
 #define SDHC_CLOCK_CTL          0x2c
 #define SDHC_SDCLK_DIV_SHIFT        8
@@ -173,6 +209,7 @@ int sdhc_intr(struct sdhc_host *);
 #define SDHC_VOLTAGE_SUPP_3_3V      (1<<24)
 #define SDHC_DMA_SUPPORT        (1<<22)
 #define SDHC_HIGH_SPEED_SUPP        (1<<21)
+#define SDHC_8BIT_SUPP          (1<<18)
 #define SDHC_BASE_FREQ_SHIFT        8
 #define SDHC_BASE_FREQ_MASK     0x3f
 #define SDHC_BASE_FREQ_MASK_V3      0xff
@@ -221,6 +258,8 @@ int sdhc_host_reset(struct sdhc_host *hp);
 int sdhc_card_detect(struct sdhc_host *hp);
 int sdhc_bus_power(struct sdhc_host *hp, u_int32_t);
 int sdhc_bus_clock(struct sdhc_host *hp, int, int);
+int sdhc_bus_high_speed(struct sdhc_host *hp);
+int sdhc_bus_width_max(struct sdhc_host *hp);
 int sdhc_bus_width(struct sdhc_host *hp, int);
 void sdhc_card_intr_mask(struct sdhc_host *hp, int);
 void sdhc_card_intr_ack(struct sdhc_host *hp);
@@ -230,4 +269,48 @@ void sdhc_exec_command(struct sdhc_host *hp, struct sdmmc_command *);
 void sdhc_async_command(struct sdhc_host *hp, struct sdmmc_command *);
 void sdhc_async_response(struct sdhc_host *hp, struct sdmmc_command *);
 
+/*
+ * Interrupt driven commands. Queued commands run one after the other, each
+ * started from the interrupt handler as soon as the last one completes, and
+ * calling its c_done (if set) from there too. sdhc_wait_command() sleeps in
+ * irq_wait() until one is done. Hangs end in a hardware timeout interrupt.
+ * Synchronous commands wait for the queue to drain before they run. Both
+ * return (and set c_error to) an errno value.
+ */
+int sdhc_queue_command(struct sdhc_host *hp, struct sdmmc_command *);
+int sdhc_wait_command(struct sdhc_host *hp, struct sdmmc_command *);
+void sdhc_wait_queue(struct sdhc_host *hp);
+
+/*
+ * Streams are open-ended multi-block reads or writes (no block count, no
+ * auto-CMD12), so one command can run across any number of buffers. Each
+ * segment pushed must be aligned to and a multiple of SDHC_STREAM_BOUNDARY:
+ * the DMA stops at every boundary, and the interrupt handler either carries
+ * on or moves to the next segment. Out of segments, the DMA just waits (and
+ * the card with it) until the next push. sdhc_stream_wait() sleeps until the
+ * first `count` segments pushed are done. Any other command on the host
+ * closes the stream first, which stops it at a block gap and sends CMD12;
+ * its owner then has to open a new one, and finds out how the close went
+ * in `error`. A write left waiting past the data timeout fails, since the
+ * blocks still in the host's buffer are lost.
+ */
+struct sdhc_stream {
+    struct sdhc_host *hp;
+    struct sdmmc_command cmd;   /* CMD18 or CMD25, set up by the card driver */
+
+    void *seg[SDHC_STREAM_SEGMENTS];
+    u_int seg_len[SDHC_STREAM_SEGMENTS];
+    volatile u_int head;        /* segment being transferred */
+    volatile u_int tail;        /* next free slot */
+    volatile u_int left;        /* bytes left of the head segment */
+
+    volatile int state;
+    volatile int error;
+};
+
+int sdhc_stream_open(struct sdhc_host *hp, struct sdhc_stream *);
+int sdhc_stream_push(struct sdhc_stream *, void *, u_int);
+int sdhc_stream_wait(struct sdhc_stream *, u_int);
+int sdhc_stream_close(struct sdhc_stream *);
+
 #endif
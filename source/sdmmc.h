@@ -23,6 +23,7 @@ typedef struct sdhc_host * sdmmc_chipset_handle_t;
 #define SDMMC_SDCLK_OFF     0
 #define SDMMC_SDCLK_400KHZ  400
 #define SDMMC_SDCLK_25MHZ   25000
+#define SDMMC_SDCLK_50MHZ   50000
 
 #define SDMMC_TIMING_LEGACY 0
 #define SDMMC_TIMING_HIGHSPEED  1
@@ -86,6 +87,7 @@ struct sdmmc_command {
 #define SCF_RSP_CRC  0x0400
 #define SCF_RSP_IDX  0x0800
 #define SCF_RSP_PRESENT  0x1000
+#define SCF_STREAM   0x2000     /* open-ended, see sdhc_stream_open() */
 /* response types */
 #define SCF_RSP_R0   0 /* none */
 #define SCF_RSP_R1   (SCF_RSP_PRESENT|SCF_RSP_CRC|SCF_RSP_IDX)
@@ -101,6 +103,10 @@ struct sdmmc_command {
 
     int     c_timeout;
 
+    /* called from the interrupt handler once a queued command is done */
+    void (*c_done)(struct sdmmc_command *, void *);
+    void *c_done_arg;
+
     /* Host controller owned fields for data xfer in progress */
     int c_resid;            /* remaining I/O */
     u_char *c_buf;          /* remaining data */
@@ -174,16 +180,20 @@ struct sdmmc_function {
 #define MMC_SET_BLOCK_COUNT     23  /* R1 */
 #define MMC_WRITE_BLOCK_SINGLE      24  /* R1 */
 #define MMC_WRITE_BLOCK_MULTIPLE    25  /* R1 */
+#define MMC_ERASE           38  /* R1B */
 #define MMC_APP_CMD         55  /* R1 */
 
 /* SD commands */               /* response type */
 #define SD_SEND_RELATIVE_ADDR       3   /* R6 */
 #define SD_SWITCH_FUNC          6   /* R1 */
 #define SD_SEND_IF_COND         8   /* R7 */
+#define SD_ERASE_WR_BLK_START       32  /* R1 */
+#define SD_ERASE_WR_BLK_END     33  /* R1 */
 
 /* SD application commands */           /* response type */
 #define SD_APP_SET_BUS_WIDTH        6   /* R1 */
 #define SD_APP_OP_COND          41  /* R3 */
+#define SD_APP_SEND_SCR         51  /* R1 */
 
 /* OCR bits */
 #define MMC_OCR_MEM_READY       (1<<31) /* memory power-up status bit */
@@ -213,6 +223,7 @@ struct sdmmc_function {
 
 /* R1 response type bits */
 #define MMC_R1_READY_FOR_DATA       (1<<8)  /* ready for next transfer */
+#define MMC_R1_SWITCH_ERROR     (1<<7)  /* MMC_SWITCH was refused */
 #define MMC_R1_APP_CMD          (1<<5)  /* app. commands supported */
 
 /* 48-bit response decoding (32 bits w/o CRC) */
@@ -228,6 +239,26 @@ struct sdmmc_function {
 #define SD_ARG_BUS_WIDTH_1      0
 #define SD_ARG_BUS_WIDTH_4      2
 
+/* MMC_SWITCH argument, writing one EXT_CSD byte */
+#define MMC_SWITCH_MODE_WRITE_BYTE  3
+#define MMC_SWITCH_ARG(index, value)                    \
+    ((MMC_SWITCH_MODE_WRITE_BYTE << 24) | ((index) << 16) | ((value) << 8) | 1)
+
+/* EXT_CSD fields */
+#define MMC_EXT_CSD_SIZE        512
+#define EXT_CSD_BUS_WIDTH       183 /* WO */
+#define  EXT_CSD_BUS_WIDTH_1        0
+#define  EXT_CSD_BUS_WIDTH_4        1
+#define  EXT_CSD_BUS_WIDTH_8        2
+#define EXT_CSD_HS_TIMING       185 /* R/W */
+#define EXT_CSD_CARD_TYPE       196 /* RO */
+#define  EXT_CSD_CARD_TYPE_26M      (1<<0)
+#define  EXT_CSD_CARD_TYPE_52M      (1<<1)
+#define EXT_CSD_SEC_COUNT       212 /* RO, 4 bytes */
+#define EXT_CSD_SEC_COUNT_VALUE(ext)                    \
+    ((u32)(ext)[EXT_CSD_SEC_COUNT] | (u32)(ext)[EXT_CSD_SEC_COUNT + 1] << 8 | \
+     (u32)(ext)[EXT_CSD_SEC_COUNT + 2] << 16 | (u32)(ext)[EXT_CSD_SEC_COUNT + 3] << 24)
+
 /* MMC R2 response (CSD) */
 #define MMC_CSD_CSDVER(resp)        MMC_RSP_BITS((resp), 126, 2)
 #define  MMC_CSD_CSDVER_1_0     1
@@ -288,6 +319,8 @@ struct sdmmc_function {
 #define  SD_CSD_SPEED_50_MHZ        0x5a
 #define SD_CSD_CCC(resp)        MMC_RSP_BITS((resp), 84, 12)
 #define  SD_CSD_CCC_ALL         0x5f5
+#define  SD_CSD_CCC_ERASE       (1<<5)
+#define  SD_CSD_CCC_SWITCH      (1<<10)
 #define SD_CSD_READ_BL_LEN(resp)    MMC_RSP_BITS((resp), 80, 4)
 #define SD_CSD_READ_BL_PARTIAL(resp)    MMC_RSP_BITS((resp), 79, 1)
 #define SD_CSD_WRITE_BLK_MISALIGN(resp) MMC_RSP_BITS((resp), 78, 1)
@@ -298,6 +331,26 @@ struct sdmmc_function {
                      (SD_CSD_C_SIZE_MULT((resp))+2))
 #define SD_CSD_V2_C_SIZE(resp)      MMC_RSP_BITS((resp), 48, 22)
 #define SD_CSD_V2_CAPACITY(resp)    ((SD_CSD_V2_C_SIZE((resp))+1) << 10)
+
+/* SCR (SD Configuration Register), 8 bytes, most significant first */
+#define SD_SCR_SIZE         8
+#define SD_SCR_SD_SPEC(scr)     ((scr)[0] & 0xf)
+#define  SD_SCR_SD_SPEC_1_10        1
+#define SD_SCR_DATA_STAT_AFTER_ERASE(scr)   (((scr)[1] >> 7) & 1)
+#define SD_SCR_BUS_WIDTHS(scr)      ((scr)[1] & 0xf)
+#define  SD_SCR_BUS_WIDTH_4     (1<<2)
+
+/* SD_SWITCH_FUNC argument, changing the access mode (group 1) only */
+#define SD_SWITCH_MODE_CHECK        (0<<31)
+#define SD_SWITCH_MODE_SET      (1<<31)
+#define SD_SWITCH_ACCESS_MODE_ARG(mode, func)   ((mode) | 0x00fffff0 | (func))
+#define  SD_ACCESS_MODE_SDR12       0 /* default speed, 25 MHz */
+#define  SD_ACCESS_MODE_SDR25       1 /* high speed, 50 MHz */
+
+/* SD_SWITCH_FUNC status, 64 bytes, most significant first */
+#define SD_SWITCH_STATUS_SIZE       64
+#define SD_SWITCH_ACCESS_MODES(st)  (((st)[12] << 8) | (st)[13]) /* supported, bits 415:400 */
+#define SD_SWITCH_ACCESS_MODE(st)   ((st)[16] & 0xf) /* selected, bits 379:376 */
 #define SD_CSD_V2_BL_LEN        0x9 /* 512 */
 #define SD_CSD_VDD_R_CURR_MIN(resp) MMC_RSP_BITS((resp), 59, 3)
 #define SD_CSD_VDD_R_CURR_MAX(resp) MMC_RSP_BITS((resp), 56, 3)
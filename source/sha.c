@@ -30,6 +30,8 @@ A million repetitions of "a"
 #define SHA_CMD_FLAG_IRQ  (1<<30)
 #define SHA_CMD_FLAG_ERR  (1<<29)
 #define SHA_CMD_AREA_BLOCK ((1<<10) - 1)
+// most blocks the engine takes per command
+#define SHA_MAX_BLOCKS (SHA_CMD_AREA_BLOCK + 1)
 
 static void sha_transform(u32 state[SHA_HASH_WORDS], u8 buffer[SHA_BLOCK_SIZE], u32 blocks)
 {
@@ -42,9 +44,13 @@ static void sha_transform(u32 state[SHA_HASH_WORDS], u8 buffer[SHA_BLOCK_SIZE],
     write32(SHA_H3, state[3]);
     write32(SHA_H4, state[4]);
 
-    // assign block to local copy which is 64-byte aligned
-    u8 *block = memalign(64, SHA_BLOCK_SIZE * blocks);
-    memcpy(block, buffer, SHA_BLOCK_SIZE * blocks);
+    // the engine DMAs straight from memory, so only unaligned data needs a
+    // 64-byte aligned local copy
+    u8 *block = buffer;
+    if((u32)buffer & (SHA_BLOCK_SIZE - 1)) {
+        block = memalign(64, SHA_BLOCK_SIZE * blocks);
+        memcpy(block, buffer, SHA_BLOCK_SIZE * blocks);
+    }
 
     // royal flush :)
     dc_flushrange(block, SHA_BLOCK_SIZE * blocks);
@@ -61,7 +67,7 @@ static void sha_transform(u32 state[SHA_HASH_WORDS], u8 buffer[SHA_BLOCK_SIZE],
     while (read32(SHA_CTRL) & SHA_CMD_FLAG_EXEC);
 
     // free the aligned data
-    free(block);
+    if(block != buffer) free(block);
 
     /* Add the working vars back into ctx.state[] */
     state[0] = read32(SHA_H0);
@@ -95,6 +101,9 @@ void sha_update(sha_ctx* ctx, const void* inbuf, size_t size)
         memcpy(&ctx->buffer[j], data, (i = 64-j));
         sha_transform(ctx->state, ctx->buffer, 1);
         // try bigger blocks at once
+        for ( ; i + 63 + ((SHA_MAX_BLOCKS-1)*64) < size; i += (64 + (SHA_MAX_BLOCKS-1)*64)) {
+            sha_transform(ctx->state, &data[i], SHA_MAX_BLOCKS);
+        }
         for ( ; i + 63 + ((BLOCKSIZE-1)*64) < size; i += (64 + (BLOCKSIZE-1)*64)) {
             sha_transform(ctx->state, &data[i], BLOCKSIZE);
         }
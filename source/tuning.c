@@ -0,0 +1,117 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *  Copyright (C) 2016          Daz Jones <daz@dazzozo.com>
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#include "tuning.h"
+#include "sdcard.h"
+#include "mlc.h"
+#include "pipeline.h"
+#include "gfx.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define TUNING_PATH     "sdmc:/minute/tuning.bin"
+#define TUNING_MAGIC    0x54554E45 // "TUNE"
+#define TUNING_VERSION  2
+
+typedef struct {
+    u32 magic;
+    u32 version;
+    u32 sd_cid[4];
+    u32 mlc_cid[4];
+    tuning_params params;
+} tuning_t;
+
+// what everything used before there was tuning
+static const tuning_params defaults = {
+    .depth = 2,
+};
+
+static tuning_params current = defaults;
+
+static bool _tuning_valid(const tuning_params* params)
+{
+    return params->depth >= 2 && params->depth <= PIPELINE_MAX_DEPTH;
+}
+
+static void _tuning_ids(tuning_t* tuning)
+{
+    memset(tuning, 0, sizeof(*tuning));
+    tuning->magic = TUNING_MAGIC;
+    tuning->version = TUNING_VERSION;
+
+    sdcard_get_cid(tuning->sd_cid);
+    mlc_get_cid(tuning->mlc_cid);
+}
+
+void tuning_load(void)
+{
+    tuning_t ids, tuning;
+    current = defaults;
+
+    FILE* file = fopen(TUNING_PATH, "rb");
+    if(!file) return;
+
+    int count = fread(&tuning, sizeof(tuning), 1, file);
+    fclose(file);
+
+    _tuning_ids(&ids);
+    if(count != 1 || tuning.magic != TUNING_MAGIC || tuning.version != TUNING_VERSION ||
+       !_tuning_valid(&tuning.params)) {
+        printf("Ignoring invalid transfer tuning %s.\n", TUNING_PATH);
+        return;
+    }
+    if(memcmp(tuning.sd_cid, ids.sd_cid, sizeof(ids.sd_cid)) ||
+       memcmp(tuning.mlc_cid, ids.mlc_cid, sizeof(ids.mlc_cid))) {
+        printf("Transfer tuning %s is for a different SD card or console, ignoring.\n", TUNING_PATH);
+        return;
+    }
+
+    current = tuning.params;
+    printf("Using tuned transfers: %lu buffers\n", current.depth);
+}
+
+int tuning_save(const tuning_params* params)
+{
+    if(!_tuning_valid(params)) return -1;
+
+    tuning_t tuning;
+    _tuning_ids(&tuning);
+    tuning.params = *params;
+
+    mkdir("sdmc:/minute", 0777);
+
+    FILE* file = fopen(TUNING_PATH, "wb");
+    if(!file) {
+        printf("Failed to open %s.\n", TUNING_PATH);
+        return -2;
+    }
+
+    int count = fwrite(&tuning, sizeof(tuning), 1, file);
+    int res = fclose(file);
+    if(count != 1 || res) {
+        printf("Failed to write %s.\n", TUNING_PATH);
+        return -3;
+    }
+
+    current = *params;
+    return 0;
+}
+
+const tuning_params* tuning_get(void)
+{
+    return &current;
+}
+
+void tuning_set(const tuning_params* params)
+{
+    if(_tuning_valid(params)) current = *params;
+}
@@ -0,0 +1,34 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *  Copyright (C) 2016          Daz Jones <daz@dazzozo.com>
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#ifndef _TUNING_H
+#define _TUNING_H
+
+#include "types.h"
+
+// Transfer parameters for the SD card and MLC, which cards differ a lot on. They
+// are calibrated by timing copies (see dump_calibrate()) and cached on SD
+// (sdmc:/minute/tuning.bin) keyed by the SD card's and MLC's CIDs. Commands are
+// always as big as they get: the pipelines' chunks stream past the command limit
+// (see struct sdhc_stream), so there's no command size left to tune.
+typedef struct {
+    // pipeline buffers, at most PIPELINE_MAX_DEPTH
+    u32 depth;
+} tuning_params;
+
+// Picks up the parameters calibrated for this SD card and MLC, if there are any.
+void tuning_load(void);
+int tuning_save(const tuning_params* params);
+
+const tuning_params* tuning_get(void);
+// Uses `params` from now on without saving them, e.g. while calibrating.
+void tuning_set(const tuning_params* params);
+
+#endif
@@ -0,0 +1,361 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *  Copyright (C) 2016          Daz Jones <daz@dazzozo.com>
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#include "host.h"
+#include "latte.h"
+#include "utils.h"
+#include "memory.h"
+#include "irq.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// the same as in nand.c
+#define NAND_RESET      0xff
+#define NAND_CHIPID     0x90
+#define NAND_GETSTATUS  0x70
+#define NAND_ERASE_PRE  0x60
+#define NAND_ERASE_POST 0xd0
+#define NAND_READ_PRE   0x00
+#define NAND_READ_POST  0x30
+#define NAND_WRITE_PRE  0x80
+#define NAND_WRITE_POST 0x10
+
+#define NAND_BUSY_MASK  0x80000000
+#define NAND_ERROR      0x20000000
+#define NAND_FLAGS_IRQ  0x40000000
+#define NAND_FLAGS_ECC  0x1000
+
+#define HOST_NAND_SIZE  ((size_t)NAND_MAX_PAGE * HOST_RAW_PAGE_SIZE)
+
+static const u8 chip_id[] = {0xAD, 0xDC, 0x80, 0x95};
+
+static int fd = -1;
+static u8* chip = NULL;
+
+static struct {
+    u32 addr0, addr1;
+    u32 data, ecc;
+    u32 bank, conf;
+    bool error;
+    // status of the last erase or program, for NAND_GETSTATUS
+    bool failed;
+
+    u32 page;
+    u8 latch[HOST_RAW_PAGE_SIZE];
+} regs;
+
+// next page each block may be programmed at, since its last erase
+static u8 block_next[NAND_MAX_BLOCK];
+static u32 fail_page = ~0;
+static u32 protect_page = 0;
+static host_nand_stats stats;
+
+static bool irq_on = true, irq_pending = false, in_irq = false;
+
+// DMA addresses are 32 bits, host pointers aren't, so hand out slots instead.
+// The low bits are kept so the driver's alignment checks still see them.
+#define DMA_SLOTS   256
+static void* dma_slots[DMA_SLOTS];
+static u32 dma_next;
+
+u32 dma_addr(void* p)
+{
+    u32 slot = dma_next++ % DMA_SLOTS;
+    dma_slots[slot] = (void*)((uintptr_t)p & ~(uintptr_t)0x7f);
+    return (slot << 7) | ((uintptr_t)p & 0x7f);
+}
+
+static u8* dma_ptr(u32 addr)
+{
+    return (u8*)dma_slots[(addr >> 7) % DMA_SLOTS] + (addr & 0x7f);
+}
+
+void dc_flushrange(const void* start, u32 size) { (void)start; (void)size; }
+void dc_invalidaterange(void* start, u32 size) { (void)start; (void)size; }
+void ahb_flush_from(enum wb_client dev) { (void)dev; }
+void ahb_flush_to(enum rb_client dev) { (void)dev; }
+void udelay(u32 d) { (void)d; }
+
+void irq_enable(u32 irq) { (void)irq; }
+void irq_disable(u32 irq) { (void)irq; }
+
+static void _host_irq_run(void)
+{
+    while(irq_pending && !in_irq) {
+        irq_pending = false;
+        in_irq = true;
+        nand_irq();
+        in_irq = false;
+    }
+}
+
+u32 irq_kill(void)
+{
+    u32 cookie = irq_on;
+    irq_on = false;
+    return cookie;
+}
+
+void irq_restore(u32 cookie)
+{
+    irq_on = cookie;
+    if(irq_on) _host_irq_run();
+}
+
+// Everything finishes right away, so waiting with nothing pending would hang.
+void irq_wait(void)
+{
+    if(!irq_pending) {
+        fprintf(stderr, "host: irq_wait() with no interrupt coming\n");
+        abort();
+    }
+    _host_irq_run();
+}
+
+static u8* _host_page(u32 pageno)
+{
+    return chip + (size_t)pageno * HOST_RAW_PAGE_SIZE;
+}
+
+// The file holds the chip inverted, so a fresh sparse file reads as erased.
+void host_nand_peek(u32 pageno, u8* raw)
+{
+    const u8* page = _host_page(pageno);
+    for(u32 i = 0; i < HOST_RAW_PAGE_SIZE; i++)
+        raw[i] = ~page[i];
+}
+
+void host_nand_poke(u32 pageno, const u8* raw)
+{
+    u8* page = _host_page(pageno);
+    for(u32 i = 0; i < HOST_RAW_PAGE_SIZE; i++)
+        page[i] = ~raw[i];
+}
+
+static bool _host_page_erased(u32 pageno)
+{
+    const u8* page = _host_page(pageno);
+    for(u32 i = 0; i < HOST_RAW_PAGE_SIZE; i++)
+        if(page[i]) return false;
+    return true;
+}
+
+// Hamming code over each 512-byte subpage: the odd half is the parity of the
+// bits whose position has each address bit set, the even half of those that
+// have it clear, so a single flipped bit shows up as its position in the odd
+// half with the complement in the even half.
+void host_ecc(const u8* data, u32* ecc)
+{
+    for(int sub = 0; sub < 4; sub++, data += 0x200) {
+        u32 odd = 0, even = 0;
+        for(u32 pos = 0; pos < 0x200 * 8; pos++) {
+            if(!(data[pos >> 3] & (1 << (pos & 7)))) continue;
+            odd ^= pos;
+            even ^= ~pos & 0xFFF;
+        }
+
+        ecc[sub] = ((even & 0xFF) << 24) | ((even >> 8) << 16) | ((odd & 0xFF) << 8) | (odd >> 8);
+    }
+}
+
+static void _host_check_page(u32 pageno)
+{
+    if(pageno < protect_page) {
+        fprintf(stderr, "host: page 0x%05X is protected\n", pageno);
+        stats.violations++;
+    }
+}
+
+static void _host_read(u32 flags)
+{
+    u8 raw[HOST_RAW_PAGE_SIZE];
+    host_nand_peek(regs.page, raw);
+    stats.reads++;
+
+    memcpy(dma_ptr(regs.data), raw, PAGE_SIZE);
+    u8* spare = dma_ptr(regs.ecc);
+    memcpy(spare, raw + PAGE_SIZE, PAGE_SPARE_SIZE);
+
+    if(flags & NAND_FLAGS_ECC) {
+        u32 calc[4];
+        host_ecc(raw, calc);
+        memcpy(spare + 0x40, calc, sizeof(calc));
+    }
+}
+
+static void _host_program(void)
+{
+    u32 pageno = regs.page;
+    u32 block = pageno / BLOCK_SIZE, page = pageno % BLOCK_SIZE;
+    _host_check_page(pageno);
+    stats.programs++;
+
+    regs.failed = pageno == fail_page;
+    if(regs.failed) {
+        regs.error = true;
+        return;
+    }
+
+    if(!_host_page_erased(pageno)) {
+        fprintf(stderr, "host: page 0x%05X programmed twice\n", pageno);
+        stats.violations++;
+    }
+    if(page < block_next[block]) {
+        fprintf(stderr, "host: page 0x%05X programmed out of order\n", pageno);
+        stats.violations++;
+    }
+    block_next[block] = page + 1;
+
+    // programming only ever clears bits
+    u8 raw[HOST_RAW_PAGE_SIZE];
+    host_nand_peek(pageno, raw);
+    for(u32 i = 0; i < HOST_RAW_PAGE_SIZE; i++)
+        raw[i] &= regs.latch[i];
+    host_nand_poke(pageno, raw);
+}
+
+static void _host_erase(void)
+{
+    u32 block = regs.page / BLOCK_SIZE;
+    _host_check_page(block * BLOCK_SIZE);
+    stats.erases++;
+    regs.failed = false;
+
+    memset(_host_page(block * BLOCK_SIZE), 0, (size_t)BLOCK_SIZE * HOST_RAW_PAGE_SIZE);
+    block_next[block] = 0;
+}
+
+static void _host_command(u32 ctrl)
+{
+    u32 cmd = (ctrl >> 16) & 0xFF;
+    regs.error = false;
+
+    switch(cmd) {
+        case NAND_RESET:
+            break;
+        case NAND_CHIPID:
+            memset(dma_ptr(regs.data), 0, ctrl & 0xFFF);
+            memcpy(dma_ptr(regs.data), chip_id, sizeof(chip_id));
+            break;
+        case NAND_GETSTATUS:
+            // ready, not write protected, and whether the last erase or program failed
+            dma_ptr(regs.data)[0] = regs.failed ? 0xE1 : 0xE0;
+            break;
+        case NAND_READ_PRE:
+        case NAND_ERASE_PRE:
+            regs.page = regs.addr1 % NAND_MAX_PAGE;
+            break;
+        case NAND_READ_POST:
+            _host_read(ctrl);
+            break;
+        case NAND_WRITE_PRE:
+            regs.page = regs.addr1 % NAND_MAX_PAGE;
+            memcpy(regs.latch, dma_ptr(regs.data), PAGE_SIZE);
+            memcpy(regs.latch + PAGE_SIZE, dma_ptr(regs.ecc), PAGE_SPARE_SIZE);
+            break;
+        case NAND_WRITE_POST:
+            _host_program();
+            break;
+        case NAND_ERASE_POST:
+            _host_erase();
+            break;
+        default:
+            fprintf(stderr, "host: unknown NAND command 0x%02X\n", cmd);
+            abort();
+    }
+
+    if(ctrl & NAND_FLAGS_IRQ) {
+        irq_pending = true;
+        if(irq_on) _host_irq_run();
+    }
+}
+
+u32 read32(u32 addr)
+{
+    switch(addr) {
+        case NAND_CTRL: return regs.error ? NAND_ERROR : 0;
+        case NAND_CONF: return regs.conf;
+        case NAND_ADDR0: return regs.addr0;
+        case NAND_ADDR1: return regs.addr1;
+        case NAND_BANK: return regs.bank;
+        default: return 0;
+    }
+}
+
+void write32(u32 addr, u32 data)
+{
+    switch(addr) {
+        case NAND_CTRL:
+            if(data & NAND_BUSY_MASK) _host_command(data);
+            break;
+        case NAND_CONF: regs.conf = data; break;
+        case NAND_ADDR0: regs.addr0 = data; break;
+        case NAND_ADDR1: regs.addr1 = data; break;
+        case NAND_DATA: regs.data = data; break;
+        case NAND_ECC: regs.ecc = data; break;
+        case NAND_BANK: regs.bank = data; break;
+        default: break;
+    }
+}
+
+int host_nand_open(const char* path)
+{
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0 || ftruncate(fd, HOST_NAND_SIZE) != 0) {
+        perror(path);
+        return -1;
+    }
+
+    chip = mmap(NULL, HOST_NAND_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(chip == MAP_FAILED) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+
+    memset(&regs, 0, sizeof(regs));
+    memset(block_next, 0, sizeof(block_next));
+    host_nand_reset_stats();
+    return 0;
+}
+
+void host_nand_close(void)
+{
+    munmap(chip, HOST_NAND_SIZE);
+    close(fd);
+    chip = NULL;
+    fd = -1;
+}
+
+void host_nand_fail_program(u32 pageno)
+{
+    fail_page = pageno;
+}
+
+void host_nand_get_stats(host_nand_stats* s)
+{
+    *s = stats;
+}
+
+void host_nand_reset_stats(void)
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+void host_nand_protect(u32 pageno)
+{
+    protect_page = pageno;
+}
@@ -0,0 +1,52 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *  Copyright (C) 2016          Daz Jones <daz@dazzozo.com>
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#ifndef _HOST_H
+#define _HOST_H
+
+#include "types.h"
+#include "nand.h"
+
+// File-backed stand-in for the NAND controller and chip, for running nand.c on
+// the host. Commands run as soon as they're written and raise their interrupt
+// right away. The chip is one bank of NAND_MAX_PAGE pages with their spare, the
+// .RAW layout, kept in a sparse file (inverted, so holes read as erased).
+#define HOST_RAW_PAGE_SIZE  (PAGE_SIZE + PAGE_SPARE_SIZE)
+
+int host_nand_open(const char* path);
+void host_nand_close(void);
+
+// Raw page as the chip has it, data followed by spare.
+void host_nand_peek(u32 pageno, u8* raw);
+void host_nand_poke(u32 pageno, const u8* raw);
+
+// Programming `pageno` fails (sets NAND_ERROR) until cleared with ~0.
+void host_nand_fail_program(u32 pageno);
+
+// What the chip went through. Violations are sequences a real chip would
+// corrupt data on or the driver must never do: programming a page that isn't
+// erased, programming a block's pages out of order, or touching a page below
+// the protected boundary.
+typedef struct {
+    u32 reads;
+    u32 erases;
+    u32 programs;
+    u32 violations;
+} host_nand_stats;
+
+void host_nand_get_stats(host_nand_stats* stats);
+void host_nand_reset_stats(void);
+void host_nand_protect(u32 pageno);
+
+// ECC the controller computes for a page, four words at `ecc`, laid out as they
+// land at spare + 0x40 (and are stored at spare + 0x30 when programmed).
+void host_ecc(const u8* data, u32* ecc);
+
+#endif
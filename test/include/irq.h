@@ -0,0 +1,23 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *  Copyright (C) 2016          Daz Jones <daz@dazzozo.com>
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#pragma once
+
+#include "types.h"
+
+// Host stand-in: interrupts are raised by the fake controller in host.c and
+// run whenever they'd be enabled, or from irq_wait().
+#define IRQ_NAND    1
+
+void irq_enable(u32 irq);
+void irq_disable(u32 irq);
+u32 irq_kill(void);
+void irq_restore(u32 cookie);
+void irq_wait(void);
@@ -0,0 +1,34 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *  Copyright (C) 2016          Daz Jones <daz@dazzozo.com>
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#ifndef __MEMORY_H__
+#define __MEMORY_H__
+
+#include "types.h"
+
+// Host stand-in: caches and AHB buffers don't exist, and DMA addresses are
+// handles the fake controller in host.c turns back into pointers.
+enum rb_client {
+    RB_IOD = 0,
+    RB_FLA = 3,
+};
+
+enum wb_client {
+    WB_FLA = 2,
+};
+
+void dc_flushrange(const void *start, u32 size);
+void dc_invalidaterange(void *start, u32 size);
+void ahb_flush_from(enum wb_client dev);
+void ahb_flush_to(enum rb_client dev);
+
+u32 dma_addr(void *);
+
+#endif
@@ -0,0 +1,25 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *  Copyright (C) 2016          Daz Jones <daz@dazzozo.com>
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#ifndef __UTILS_H__
+#define __UTILS_H__
+
+#include "types.h"
+
+// Host stand-in: register accesses go to the fake controller in host.c.
+u32 read32(u32 addr);
+void write32(u32 addr, u32 data);
+
+void udelay(u32 d);
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+#endif
@@ -0,0 +1,490 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *  Copyright (C) 2016          Daz Jones <daz@dazzozo.com>
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#include "host.h"
+#include "nand.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define RAW_BLOCK_SIZE  (BLOCK_SIZE * HOST_RAW_PAGE_SIZE)
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+    if(!(cond)) { \
+        printf("FAIL %s:%d: ", __func__, __LINE__); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+        failures++; \
+    } \
+} while(0)
+
+// nand_correct() as it was before the closed-form rewrite, the reference the
+// new one has to match. The report it printed for every corrected page goes to
+// a buffer instead, so the benchmark still pays for formatting it.
+static char old_report[128];
+
+static int nand_correct_old(u32 pageno, void *data, void *ecc)
+{
+    u8 *dp = (u8*)data;
+    u32 *ecc_read = (u32*)((u8*)ecc+0x30);
+    u32 *ecc_calc = (u32*)((u8*)ecc+0x40);
+    int i;
+    int uncorrectable = 0;
+    int corrected = 0;
+
+    for(i=0;i<4;i++) {
+        u32 syndrome = *ecc_read ^ *ecc_calc; //calculate ECC syncrome
+        // don't try to correct unformatted pages (all FF)
+        if ((*ecc_read != 0xFFFFFFFF) && syndrome) {
+            if(!((syndrome-1)&syndrome)) {
+                // single-bit error in ECC
+                corrected++;
+            } else {
+                // byteswap and extract odd and even halves
+                u16 even = (syndrome >> 24) | ((syndrome >> 8) & 0xf00);
+                u16 odd = ((syndrome << 8) & 0xf00) | ((syndrome >> 8) & 0x0ff);
+                if((even ^ odd) != 0xfff) {
+                    // oops, can't fix this one
+                    uncorrectable++;
+                } else {
+                    // fix the bad bit
+                    dp[odd >> 3] ^= 1<<(odd&7);
+                    corrected++;
+                }
+            }
+        }
+        dp += 0x200;
+        ecc_read++;
+        ecc_calc++;
+    }
+    if(uncorrectable || corrected)
+        snprintf(old_report, sizeof(old_report), "ECC stats for NAND page 0x%X: %d uncorrectable, %d corrected\n", pageno, uncorrectable, corrected);
+    if(uncorrectable)
+        return NAND_ECC_UNCORRECTABLE;
+    if(corrected)
+        return NAND_ECC_CORRECTED;
+    return NAND_ECC_OK;
+}
+
+static u32 rng = 0x12345678;
+
+static u32 _rand(void)
+{
+    // xorshift32, so runs are repeatable
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static void _fill_random(u8* buf, u32 size)
+{
+    for(u32 i = 0; i < size; i++)
+        buf[i] = _rand();
+}
+
+// A page as the controller hands it over: data, then the spare with the stored
+// ECC at 0x30 and the one computed on the way in at 0x40.
+typedef struct {
+    u8 data[PAGE_SIZE];
+    u8 ecc[ECC_BUFFER_ALLOC];
+} test_page;
+
+static u32* _ecc_read(test_page* p) { return (u32*)(p->ecc + 0x30); }
+static u32* _ecc_calc(test_page* p) { return (u32*)(p->ecc + 0x40); }
+
+// Every single-bit error, in data or in the stored ECC, of every subpage is
+// corrected by both versions, to the original data.
+static void test_ecc_single(void)
+{
+    static test_page clean, page, old;
+
+    _fill_random(clean.data, PAGE_SIZE);
+    memset(clean.ecc, 0xFF, sizeof(clean.ecc));
+    host_ecc(clean.data, _ecc_read(&clean));
+
+    for(u32 sub = 0; sub < 4; sub++) {
+        for(u32 bit = 0; bit < 0x200 * 8 + 32; bit++) {
+            page = clean;
+            if(bit < 0x200 * 8)
+                page.data[sub * 0x200 + (bit >> 3)] ^= 1 << (bit & 7);
+            else
+                _ecc_read(&page)[sub] ^= 1 << (bit - 0x200 * 8);
+            host_ecc(page.data, _ecc_calc(&page));
+            old = page;
+
+            int res = nand_correct(0, page.data, page.ecc);
+            int old_res = nand_correct_old(0, old.data, old.ecc);
+
+            CHECK(res == NAND_ECC_CORRECTED, "subpage %u bit %u: got %d", sub, bit, res);
+            CHECK(old_res == res, "subpage %u bit %u: old %d, new %d", sub, bit, old_res, res);
+            CHECK(!memcmp(page.data, clean.data, PAGE_SIZE), "subpage %u bit %u: not corrected", sub, bit);
+            CHECK(!memcmp(old.data, clean.data, PAGE_SIZE), "subpage %u bit %u: old not corrected", sub, bit);
+        }
+    }
+}
+
+// Every pair of errors in a subpage (data or stored ECC bits) gets the same
+// verdict and leaves the same data from both versions. Double errors can't be
+// corrected, and some even look like a single one, so this only checks that
+// the new version agrees, not that it's right.
+static void test_ecc_double(void)
+{
+    // syndromes of single errors, all data bits and then all ECC bits
+    static u32 single[0x200 * 8 + 32];
+    const u32 count = sizeof(single) / sizeof(single[0]);
+    for(u32 pos = 0; pos < 0x200 * 8; pos++) {
+        u32 odd = pos, even = ~pos & 0xFFF;
+        single[pos] = ((even & 0xFF) << 24) | ((even >> 8) << 16) | ((odd & 0xFF) << 8) | (odd >> 8);
+    }
+    for(u32 bit = 0; bit < 32; bit++)
+        single[0x200 * 8 + bit] = 1u << bit;
+
+    static test_page page, old;
+    memset(&page, 0, sizeof(page));
+    const u32 stored = 0x5A3C96E1;
+
+    u32 tested = 0, mismatches = 0;
+    for(u32 sub = 0; sub < 4; sub += 3) {
+        for(u32 i = 0; i < count; i++) {
+            for(u32 j = i + 1; j < count; j++) {
+                memset(page.data + sub * 0x200, 0, 0x200);
+                memset(old.data + sub * 0x200, 0, 0x200);
+                for(u32 k = 0; k < 4; k++)
+                    _ecc_read(&page)[k] = _ecc_calc(&page)[k] = stored;
+                _ecc_calc(&page)[sub] ^= single[i] ^ single[j];
+                memcpy(old.ecc, page.ecc, sizeof(page.ecc));
+
+                int res = nand_correct(0, page.data, page.ecc);
+                int old_res = nand_correct_old(0, old.data, old.ecc);
+                tested++;
+
+                if(res != old_res || memcmp(page.data + sub * 0x200, old.data + sub * 0x200, 0x200)) {
+                    if(!mismatches++)
+                        printf("subpage %u errors %u and %u: old %d, new %d\n", sub, i, j, old_res, res);
+                }
+            }
+        }
+    }
+
+    CHECK(!mismatches, "%u of %u error pairs differ", mismatches, tested);
+}
+
+// Random syndromes anywhere in the 32-bit space, and erased pages, which are
+// never corrected.
+static void test_ecc_random(void)
+{
+    static test_page page, old;
+    u32 mismatches = 0;
+
+    for(u32 n = 0; n < 4000000; n++) {
+        memset(page.data, 0, PAGE_SIZE);
+        memset(old.data, 0, PAGE_SIZE);
+        for(u32 k = 0; k < 4; k++) {
+            u32 stored = (_rand() & 7) ? _rand() : 0xFFFFFFFF;
+            _ecc_read(&page)[k] = stored;
+            _ecc_calc(&page)[k] = (_rand() & 1) ? stored : stored ^ _rand();
+        }
+        memcpy(old.ecc, page.ecc, sizeof(page.ecc));
+
+        int res = nand_correct(0, page.data, page.ecc);
+        int old_res = nand_correct_old(0, old.data, old.ecc);
+        if(res != old_res || memcmp(page.data, old.data, PAGE_SIZE)) mismatches++;
+    }
+
+    CHECK(!mismatches, "%u random syndromes differ", mismatches);
+
+    memset(page.data, 0xFF, PAGE_SIZE);
+    memset(page.ecc, 0xFF, sizeof(page.ecc));
+    _ecc_calc(&page)[2] = 0x12345678;
+    CHECK(nand_correct(0, page.data, page.ecc) == NAND_ECC_OK, "erased page corrected");
+}
+
+static double _now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void _bench_one(const char* name, int (*correct)(u32, void*, void*), test_page* pages, u32 count)
+{
+    const u32 rounds = 200;
+    double start = _now();
+    for(u32 r = 0; r < rounds; r++)
+        for(u32 i = 0; i < count; i++)
+            correct(i, pages[i].data, pages[i].ecc);
+    double ns = (_now() - start) * 1e9 / ((double)rounds * count);
+
+    printf("  %-4s %7.1f ns/page\n", name, ns);
+}
+
+// Clean pages are what a dump almost always sees; pages with a corrected bit
+// are where the old version printed. Each bad page is corrected back and forth,
+// since the stored ECC stays wrong.
+static void bench_ecc(void)
+{
+    const u32 count = 4096;
+    test_page* pages = malloc(count * sizeof(test_page));
+
+    for(u32 i = 0; i < count; i++) {
+        _fill_random(pages[i].data, PAGE_SIZE);
+        memset(pages[i].ecc, 0xFF, sizeof(pages[i].ecc));
+        host_ecc(pages[i].data, _ecc_read(&pages[i]));
+        host_ecc(pages[i].data, _ecc_calc(&pages[i]));
+    }
+
+    printf("clean pages:\n");
+    _bench_one("old", nand_correct_old, pages, count);
+    _bench_one("new", nand_correct, pages, count);
+
+    for(u32 i = 0; i < count; i++) {
+        u32 bit = _rand() % (0x200 * 8);
+        pages[i].data[bit >> 3] ^= 1 << (bit & 7);
+        host_ecc(pages[i].data, _ecc_calc(&pages[i]));
+    }
+
+    printf("pages with one bad bit:\n");
+    _bench_one("old", nand_correct_old, pages, count);
+    _bench_one("new", nand_correct, pages, count);
+
+    free(pages);
+}
+
+// A block as SLC.RAW has it: pages with their spare, a good block marker and
+// the ECC the controller would have stored, some pages left erased.
+static void _make_block(u8* image, u32 erased_every)
+{
+    for(u32 i = 0; i < BLOCK_SIZE; i++) {
+        u8* page = image + i * HOST_RAW_PAGE_SIZE;
+        if(erased_every && (i % erased_every) == erased_every - 1) {
+            memset(page, 0xFF, HOST_RAW_PAGE_SIZE);
+            continue;
+        }
+
+        _fill_random(page, PAGE_SIZE);
+        memset(page + PAGE_SIZE, 0xFF, PAGE_SPARE_SIZE);
+        u32 ecc[4];
+        host_ecc(page, ecc);
+        memcpy(page + PAGE_SIZE + 0x30, ecc, sizeof(ecc));
+    }
+}
+
+static u32 _block_pages(const u8* image)
+{
+    u32 pages = 0;
+    for(u32 i = 0; i < BLOCK_SIZE; i++) {
+        const u8* page = image + i * HOST_RAW_PAGE_SIZE;
+        for(u32 j = 0; j < HOST_RAW_PAGE_SIZE; j++) {
+            if(page[j] != 0xFF) {
+                pages++;
+                break;
+            }
+        }
+    }
+    return pages;
+}
+
+// Reads the block back through the ring like the restore does, checking data,
+// spare and ECC against the image.
+static bool _block_matches(u32 block, const u8* image)
+{
+    static u8 buf[BLOCK_SIZE * PAGE_SIZE] ALIGNED(64);
+    nand_ring ring = {
+        .pageno = block * BLOCK_SIZE,
+        .count = BLOCK_SIZE,
+        .data = buf,
+        .stride = PAGE_SIZE,
+        .slots = BLOCK_SIZE,
+    };
+    bool match = true;
+
+    nand_ring_start(&ring);
+    for(u32 page = 0; page < BLOCK_SIZE; page++) {
+        void* data = NULL; void* ecc = NULL;
+        int res = nand_ring_wait(&ring, &data, &ecc);
+
+        const u8* raw = image + page * HOST_RAW_PAGE_SIZE;
+        if(res == NAND_ECC_UNCORRECTABLE || memcmp(data, raw, PAGE_SIZE) ||
+           memcmp(ecc, raw + PAGE_SIZE, PAGE_SPARE_SIZE))
+            match = false;
+    }
+    nand_ring_stop(&ring);
+
+    return match;
+}
+
+static void test_program_block(void)
+{
+    static u8 image[RAW_BLOCK_SIZE], raw[HOST_RAW_PAGE_SIZE];
+    const u32 block = 0x100;
+    host_nand_stats stats;
+
+    // whatever was there before has to go, which only an erase does
+    _make_block(image, 0);
+    for(u32 i = 0; i < BLOCK_SIZE; i++)
+        host_nand_poke(block * BLOCK_SIZE + i, image + i * HOST_RAW_PAGE_SIZE);
+
+    _make_block(image, 5);
+    host_nand_reset_stats();
+
+    nand_program prog = {.pageno = block * BLOCK_SIZE, .data = image, .stride = HOST_RAW_PAGE_SIZE};
+    CHECK(nand_program_start(&prog) == 0, "start failed");
+    CHECK(nand_program_wait(&prog) == 0, "program failed");
+
+    host_nand_get_stats(&stats);
+    CHECK(stats.erases == 1, "%u erases", stats.erases);
+    CHECK(stats.programs == _block_pages(image), "%u pages programmed, %u in the image", stats.programs, _block_pages(image));
+    CHECK(!stats.violations, "%u violations", stats.violations);
+
+    for(u32 i = 0; i < BLOCK_SIZE; i++) {
+        host_nand_peek(block * BLOCK_SIZE + i, raw);
+        CHECK(!memcmp(raw, image + i * HOST_RAW_PAGE_SIZE, HOST_RAW_PAGE_SIZE), "page %u differs", i);
+    }
+    CHECK(_block_matches(block, image), "doesn't read back");
+}
+
+static void test_program_protected(void)
+{
+    static u8 image[RAW_BLOCK_SIZE];
+    host_nand_stats stats;
+
+    _make_block(image, 0);
+    host_nand_reset_stats();
+
+    // boot1/boot2, and a start that isn't a block
+    nand_program prog = {.pageno = 0, .data = image, .stride = HOST_RAW_PAGE_SIZE};
+    CHECK(nand_program_start(&prog) != 0, "boot1 programmed");
+    prog.pageno = nand_get_min_page() - BLOCK_SIZE;
+    CHECK(nand_program_start(&prog) != 0, "boot2 programmed");
+    prog.pageno = nand_get_min_page() + 1;
+    CHECK(nand_program_start(&prog) != 0, "unaligned block programmed");
+
+    host_nand_get_stats(&stats);
+    CHECK(!stats.erases && !stats.programs, "%u erases, %u programs", stats.erases, stats.programs);
+}
+
+static void test_program_fail(void)
+{
+    static u8 image[RAW_BLOCK_SIZE];
+    const u32 block = 0x200;
+
+    _make_block(image, 0);
+    host_nand_fail_program(block * BLOCK_SIZE + 7);
+
+    nand_program prog = {.pageno = block * BLOCK_SIZE, .data = image, .stride = HOST_RAW_PAGE_SIZE};
+    CHECK(nand_program_start(&prog) == 0, "start failed");
+    CHECK(nand_program_wait(&prog) != 0, "failed page not reported");
+    CHECK(!_block_matches(block, image), "block matches without page 7");
+
+    // the next try goes through
+    host_nand_fail_program(~0);
+    CHECK(nand_program_start(&prog) == 0, "start failed");
+    CHECK(nand_program_wait(&prog) == 0, "retry failed");
+    CHECK(_block_matches(block, image), "retry doesn't read back");
+}
+
+// The restore's loop: blocks that already match are left alone, the rest are
+// erased and programmed while the next block is prepared (read from SD there).
+static void test_restore(void)
+{
+    #define RESTORE_BLOCKS  32
+    const u32 first = 0x300, count = RESTORE_BLOCKS;
+    static u8 image[RESTORE_BLOCKS][RAW_BLOCK_SIZE];
+    host_nand_stats stats;
+
+    for(u32 i = 0; i < count; i++)
+        _make_block(image[i], i % 4 ? 0 : 3);
+
+    // a few blocks are there already
+    u32 present = 0;
+    for(u32 i = 0; i < count; i += 5, present++) {
+        nand_program prog = {.pageno = (first + i) * BLOCK_SIZE, .data = image[i], .stride = HOST_RAW_PAGE_SIZE};
+        nand_program_start(&prog);
+        nand_program_wait(&prog);
+    }
+    host_nand_reset_stats();
+
+    u32 programmed = 0, matched = 0, failed = 0;
+    static u8 buf[2][RAW_BLOCK_SIZE];
+    memcpy(buf[0], image[0], RAW_BLOCK_SIZE);
+
+    for(u32 i = 0; i < count; i++) {
+        u8* cur = buf[i & 1];
+        nand_program prog = {.pageno = (first + i) * BLOCK_SIZE, .data = cur, .stride = HOST_RAW_PAGE_SIZE};
+        bool busy = false;
+
+        if(_block_matches(first + i, cur))
+            matched++;
+        else if(nand_program_start(&prog) == 0)
+            busy = true;
+        else
+            failed++;
+
+        if(i + 1 < count)
+            memcpy(buf[(i + 1) & 1], image[i + 1], RAW_BLOCK_SIZE);
+
+        if(busy) {
+            if(nand_program_wait(&prog) || !_block_matches(first + i, cur)) failed++;
+            else programmed++;
+        }
+    }
+
+    host_nand_get_stats(&stats);
+    CHECK(matched == present, "%u matched, %u were there", matched, present);
+    CHECK(programmed == count - present && !failed, "%u programmed, %u failed", programmed, failed);
+    CHECK(stats.erases == count - present, "%u erases", stats.erases);
+    CHECK(!stats.violations, "%u violations", stats.violations);
+
+    for(u32 i = 0; i < count; i++)
+        CHECK(_block_matches(first + i, image[i]), "block 0x%03X differs", first + i);
+}
+
+int main(int argc, char** argv)
+{
+    if(argc > 1 && !strcmp(argv[1], "bench")) {
+        bench_ecc();
+        return 0;
+    }
+
+    const char* path = argc > 1 ? argv[1] : "nand_test.img";
+    if(host_nand_open(path)) return 1;
+
+    nand_initialize(NAND_BANK_SLC);
+    host_nand_protect(nand_get_min_page());
+
+    static const struct {
+        const char* name;
+        void (*run)(void);
+    } tests[] = {
+        {"ecc_single", test_ecc_single},
+        {"ecc_double", test_ecc_double},
+        {"ecc_random", test_ecc_random},
+        {"program_block", test_program_block},
+        {"program_protected", test_program_protected},
+        {"program_fail", test_program_fail},
+        {"restore", test_restore},
+    };
+
+    for(u32 i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        int before = failures;
+        tests[i].run();
+        printf("%s %s\n", failures == before ? "ok  " : "FAIL", tests[i].name);
+    }
+
+    host_nand_close();
+    remove(path);
+
+    return failures ? 1 : 0;
+}